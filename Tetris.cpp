@@ -1,1117 +1,8214 @@
-/******************************************************************************************/
-/*                                                                                        */
-/*  WinTris - Tetris For Windows														  */
-/*  Original: August 17, 2002                                                             */
-/*  Modified: May 18, 2008																  */
-/*  Dave Behnke                                                                           */
-/*                                                                                        */
-/******************************************************************************************/
-
-#define STRICT
-#define WIN32_LEAN_AND_MEAN
-
-#include <windows.h>
-#include <tchar.h>
-#include <limits.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <mmsystem.h>
-#include "resource.h"
-
-HDC g_hdc = NULL;
-HINSTANCE g_hInstance = NULL;
-HWND g_hWnd = NULL;
-
-HBITMAP hbmBuffer = NULL, hbmBackground = NULL;
-HDC hdcBuffer = NULL, hdcBackground = NULL;
-
-DWORD current_time = 0, last_time = 0;
-BOOL fDropped = FALSE, fStart = FALSE, fActive = FALSE;
-
-PTCHAR szBuffer = NULL, szLevel = NULL, szRows = NULL, szScore = NULL;
-const int STRING_BUFFER_SIZE = 256;
-
-const int COLOR_COUNT = 9;
-
-enum color_type { RED = 0, ORANGE, YELLOW, GREEN, BLUE, WHITE, MAGENTA, BLACK, GRAY };
-
-COLORREF color_value[COLOR_COUNT] = { RGB( 255, 0, 0 ), RGB( 255, 128, 0 ), RGB( 255, 255, 0 ), 
-									RGB( 0, 255, 0 ), RGB( 0, 0, 255 ), RGB( 255, 255, 255 ), RGB( 255, 0, 128 ), 									 
-									RGB( 0, 0, 0 ), RGB( 127, 127, 127) };
-
-HBRUSH brush_index[COLOR_COUNT] = { 0 };
-
-int text_offset_x = 0, text_offset_y = 0;
-int level = 0, rows_per_level = 0, full_rows = 0, total_rows = 0, score = 0;
-unsigned long speed[20] = { 290, 285, 280, 275, 270, 265, 240, 215, 190, 165, 
-							160, 155, 150, 145, 140, 135, 125, 120, 115, 90 };
-
-const int PIECE_COUNT = 7;
-
-const int INFO_WIDTH = 6;
-
-const int FIELD_WIDTH = 12;
-const int FIELD_HEIGHT = 28;
-
-const int BRICK_WIDTH = 16;
-const int BRICK_HEIGHT = 16;
-
-const int SCORE_MAX_NAME = 8;
-
-struct score_t
-{
-	TCHAR name[SCORE_MAX_NAME];
-	int score;
-};
-
-struct score_t hall_of_fame[3];
-
-struct shape_t
-{
-	int count;
-	int shape[4];
-	enum color_type color;
-};
-
-struct shape_t shapes[7] = 
-{	  										  
-	{ 0x0001, 0xCC00, 0x0000, 0x0000, 0x0000, RED },
-	{ 0x0004, 0x4444, 0x0F00, 0x2222, 0x0F00, ORANGE },
-	{ 0x0004, 0x4E00, 0x4C40, 0x0E40, 0x4640, YELLOW },
-	{ 0x0004, 0x4460, 0x0E80, 0xC440, 0x2E00, GREEN },
-	{ 0x0004, 0x44C0, 0x8E00, 0x6440, 0x0E20, BLUE },
-	{ 0x0002, 0x4C80, 0xC600, 0x0000, 0x0000, WHITE },
-	{ 0x0002, 0x8C40, 0x6C00, 0x0000, 0x0000, MAGENTA }
-};
-
-struct piece_t
-{
-	int x, y;
-	int rotation;
-	int shape;
-};
-
-struct piece_t active_piece, next_piece;
-
-struct brick_t
-{
-	RECT rect;
-	enum color_type color;
-};
-
-struct brick_t field[FIELD_HEIGHT][FIELD_WIDTH + INFO_WIDTH];
-
-void create_piece(struct piece_t *active_piece, struct piece_t *next_piece)
-{
-	active_piece->rotation = next_piece->rotation;
-	active_piece->shape = next_piece->shape;
-	active_piece->x = 4;
-	active_piece->y = 0;
-
-	next_piece->shape = rand() % 7;
-	next_piece->rotation = rand() % shapes[next_piece->shape].count;
-	next_piece->x = 13;
-	next_piece->y = 3;
-}
-
-// return TRUE if move is possible, FALSE if impossible
-inline BOOL check_piece(struct piece_t *piece)
-{
-	int row = 0, col = 0;
-	
-	for (int bit = 0x8000; bit >= 0x0001; bit >>= 1)
-	{
-		if (shapes[piece->shape].shape[piece->rotation] & bit) {
-			if (field[piece->y + row][piece->x + col].color != BLACK) {
-				return FALSE;		
-			}
-		}
-
-		col++;
-		if (col == 4) {
-			row++;
-			col = 0;
-		}
-	}
-
-	return TRUE;
-}
-
-void rotate_piece(struct piece_t *piece)
-{
-	int previous_rotation = piece->rotation;
-
-	piece->rotation++;
-	if (piece->rotation == shapes[piece->shape].count)
-		piece->rotation = 0;
-
-	if (!check_piece(piece))
-		piece->rotation = previous_rotation;
-}
-
-void erase_piece(struct piece_t *piece)
-{
-	int col = 0, row = 0;
-	
-	for (int bit = 0x8000; bit >= 0x0001; bit >>= 1)
-	{
-		if (shapes[piece->shape].shape[piece->rotation] & bit) {
-			field[piece->y + row][piece->x + col].color = BLACK;
-		}
-
-		col++;
-		if (col == 4) {
-			row++;
-			col = 0;
-		}
-	}
-}
-
-void draw_piece(struct piece_t *piece)
-{
-	int col = 0, row = 0;
-	
-	for (int bit = 0x8000; bit >= 0x0001; bit >>= 1)
-	{
-		if (shapes[piece->shape].shape[piece->rotation] & bit) {
-			field[piece->y + row][piece->x + col].color = shapes[piece->shape].color;
-		}
-
-		col++;
-		if (col == 4) {
-			row++;
-			col = 0;
-		}
-	}
-}
-
-void left_piece(struct piece_t *piece)
-{
-	--piece->x;
-
-	if (!check_piece(piece))
-		++piece->x;
-}
-
-void right_piece(struct piece_t *piece)
-{
-	++piece->x;
-
-	if (!check_piece(piece))
-		--piece->x;
-}
-
-// false if piece not moved down - true if piece moved down
-BOOL down_piece(struct piece_t *piece)
-{
-	++piece->y;
-	if (!check_piece(piece)) {
-		--piece->y;
-		return FALSE;
-	}
-
-	return TRUE;
-}
-
-int drop_piece(struct piece_t *piece)
-{
-	int height = piece->y;
-
-	do {
-		++piece->y;
-	} while (check_piece(piece));
-	--piece->y;
-
-	return piece->y - height;
-}
-
-int next_full_row(void)
-{
-	int count;
-
-	for (int row = FIELD_HEIGHT - 2; row > 0; row--)
-	{
-		count = 0;
-
-		for (int col = 1; col < FIELD_WIDTH - 1; col++)
-		{
-			if (field[row][col].color != BLACK)
-				count++;
-		}
-
-		if (count == FIELD_WIDTH - 2)
-			return row;
-	}
-
-	return -1;
-}
-
-void remove_row(int row)
-{
-	for (int j = row; j > 0; j--)
-	{
-		for (int k = 0; k < FIELD_WIDTH; k++)
-		{
-			field[j][k].color = field[j - 1][k].color;
-		}
-	}
-}
-
-int remove_full_rows(void)
-{
-	int count = 0;
-	int row = -1;
-	
-	while ((row = next_full_row()) != -1)
-	{
-		remove_row(row);
-		count++;
-	}
-
-	return count;
-}
-
-void make_field(int x, int y)
-{
-	for (int row = 0; row < FIELD_HEIGHT; row++)
-	{
-		for (int col = 0; col < FIELD_WIDTH + INFO_WIDTH; col++)
-		{
-			if (col == 0 || col >= FIELD_WIDTH - 1 || row == FIELD_HEIGHT - 1)
-				field[row][col].color = GRAY;
-			else
-				field[row][col].color = BLACK;
-
-			SetRect(&field[row][col].rect, x + (BRICK_WIDTH * col) + 1, y + (BRICK_HEIGHT * row) + 1, 
-					x + (BRICK_WIDTH * col + BRICK_WIDTH) - 1, y + (BRICK_HEIGHT * row + BRICK_HEIGHT) - 1);
-		}
-	}
-
-	for (int row = 2; row < 7; row++)
-	{
-		for (int col = 12; col < 17; col++)
-		{
-			field[row][col].color = BLACK;
-		}
-	}
-}
-
-void clear_field(enum color_type color)
-{
-	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
-	{
-		for (int col = 1; col < FIELD_WIDTH - 1; col++)
-		{
-			field[row][col].color = color;
-		}
-	}
-}
-
-void draw_field(HDC hdc)
-{
-	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
-	{
-		for (int col = 1; col < FIELD_WIDTH - 1; col++)
-		{
-			FillRect(hdc, &field[row][col].rect, brush_index[field[row][col].color]);
-		}
-	}
-
-	for (int row = 2; row < 7; row++)
-	{
-		for (int col = 12; col < 17; col++)
-		{
-			FillRect(hdc, &field[row][col].rect, brush_index[field[row][col].color]);
-		}
-	}
-}
-
-void render_frame()
-{
-	BitBlt(hdcBuffer, 0, 0, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1), hdcBackground, 0, 0, SRCCOPY);
-	
-	draw_field(hdcBuffer);
-	
-	if (NULL != szLevel)
-	{
-		TextOut(hdcBuffer, BRICK_WIDTH * (FIELD_WIDTH - 1) + text_offset_x, BRICK_HEIGHT * 9 + text_offset_y, szLevel, static_cast<int>(_tcslen(szLevel)));
-	}
-
-	if (NULL != szRows)
-	{
-		TextOut(hdcBuffer, BRICK_WIDTH * (FIELD_WIDTH - 1) + text_offset_x, BRICK_HEIGHT * 13 + text_offset_y, szRows, static_cast<int>(_tcslen(szRows)));
-	}
-
-	if (NULL != szScore)
-	{
-		TextOut(hdcBuffer, BRICK_WIDTH * (FIELD_WIDTH - 1) + text_offset_x, BRICK_HEIGHT * 17 + text_offset_y, szScore, static_cast<int>(_tcslen(szScore)));
-	}
-
-	BitBlt(g_hdc, 0, 0, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1), hdcBuffer, 0, 0, SRCCOPY);	
-}
-
-void process_input(void)
-{
-	static SHORT LastKeyPressed = 0;
-	static DWORD StartTime = 0;
-
-	if (LastKeyPressed)
-	{
-		if (GetAsyncKeyState(LastKeyPressed) & 0x8000)
-		{
-			if ((timeGetTime() - StartTime) >= 175)
-			{
-				LastKeyPressed = 0;
-			}
-			else
-			{
-				return;
-			}
-		}
-		else
-		{
-			LastKeyPressed = 0;
-		}
-	}
-
-	if ((GetAsyncKeyState(VK_SPACE) & 0x8000) && !fStart)
-	{
-		fStart = !fStart;
-
-		clear_field(BLACK);
-
-		level = 0, rows_per_level = 0, full_rows = 0, total_rows = 0, score = 0;
-
-		draw_piece(&active_piece);
-		draw_piece(&next_piece);
-
-		if (NULL != szLevel)
-		{
-			ZeroMemory(szLevel, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-			_stprintf_s(szLevel, STRING_BUFFER_SIZE, TEXT("%0.6d"), level + 1);
-		}
-
-		if (NULL != szScore)
-		{
-			ZeroMemory(szScore, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-			_stprintf_s(szScore, STRING_BUFFER_SIZE, TEXT("%0.6d"), score);
-		}
-
-		if (NULL != szRows)
-		{
-			ZeroMemory(szRows, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-			_stprintf_s(szRows, STRING_BUFFER_SIZE, TEXT("%0.6d"), total_rows);
-		}
-
-		LastKeyPressed = VK_SPACE;
-	}
-	else if ((GetAsyncKeyState(VK_UP) & 0x8000) && fStart)
-	{
-		erase_piece(&active_piece);
-		rotate_piece(&active_piece);					
-		draw_piece(&active_piece);
-
-		LastKeyPressed = VK_UP;
-	}
-	else if ((GetAsyncKeyState(VK_RIGHT) & 0x8000) && fStart)
-	{
-		erase_piece(&active_piece);
-		right_piece(&active_piece);
-		draw_piece(&active_piece);
-
-		LastKeyPressed = VK_RIGHT;
-	}
-	else if ((GetAsyncKeyState(VK_LEFT) & 0x8000) && fStart)
-	{
-		erase_piece(&active_piece);
-		left_piece(&active_piece);
-		draw_piece(&active_piece);
-
-		LastKeyPressed = VK_LEFT;
-	}
-	else if ((GetAsyncKeyState(VK_DOWN) & 0x8000) && fStart)
-	{
-		erase_piece(&active_piece);
-		score += drop_piece(&active_piece);
-		draw_piece(&active_piece);
-
-		LastKeyPressed = VK_DOWN;
-	}
-	else if (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
-	{
-		PostMessage(g_hWnd, WM_CLOSE, 0, 0);
-	}
-
-	if (LastKeyPressed)
-	{
-		StartTime = timeGetTime();
-	}
-}
-
-unsigned long hash_time(void)
-{
-	unsigned long hash = 0, now = GetTickCount();
-	char *p = (char *)&now;
-	
-	for (int i = 0; i < sizeof(unsigned long); i++)
-		hash = hash * (2U * CHAR_MAX) + *p++;
-
-	return hash;
-}
-
-void read_hof(void)
-{
-	HKEY hKey;
-	DWORD dwDisp;
-
-	RegCreateKeyEx(HKEY_CURRENT_USER, TEXT("Tetris"), 0, TEXT(""), 0, KEY_READ | KEY_WRITE, NULL, &hKey, &dwDisp);
-
-	if (dwDisp == REG_CREATED_NEW_KEY)
-	{
-		ZeroMemory(&hall_of_fame, sizeof(struct score_t) * 3);
-			
-		TCHAR szText[] = TEXT(".......");
-		for (int i = 0; i < 3; i++)
-		{
-			_tcscpy_s(hall_of_fame[i].name, SCORE_MAX_NAME, szText);				
-			hall_of_fame[i].score = 0;
-		}
-	
-		RegSetValueEx(hKey, NULL, 0, REG_BINARY, (PBYTE)&hall_of_fame, sizeof(struct score_t) * 3);
-	}
-	else
-	{
-		DWORD size = sizeof(struct score_t) * 3;
-		RegQueryValueEx(hKey, NULL, NULL, NULL, (PBYTE)&hall_of_fame, &size);
-	}
-
-	RegCloseKey(hKey);
-}
-
-void write_hof(void)
-{
-	HKEY hKey;
-	DWORD dwDisp;
-
-	RegCreateKeyEx(HKEY_CURRENT_USER, TEXT("Tetris"), 0, TEXT(""), 0, KEY_READ | KEY_WRITE, NULL, &hKey, &dwDisp);
-
-	if (dwDisp == REG_CREATED_NEW_KEY)
-	{
-		ZeroMemory(&hall_of_fame, sizeof(struct score_t) * 3);
-			
-		TCHAR szText[] = TEXT(".......");
-		for (int i = 0; i < 3; i++)
-		{
-			_tcscpy_s(hall_of_fame[i].name, SCORE_MAX_NAME, szText);				
-			hall_of_fame[i].score = 0;
-		}
-	}
-
-	RegSetValueEx(hKey, NULL, 0, REG_BINARY, (PBYTE)&hall_of_fame, sizeof(struct score_t) * 3);
-	RegCloseKey(hKey);
-}
-
-BOOL CALLBACK HOFDlgProc(HWND hWndDlg, UINT message, WPARAM wParam, LPARAM lParam) 
-{ 
-    switch (message) 
-    { 
-	case WM_INITDIALOG:
-		{
-#pragma warning( disable : 4311 ) // 'type cast' : pointer truncation from 'HICON' to 'LONG'
-			SetClassLong(hWndDlg, GCL_HICON, (LONG) LoadIcon(g_hInstance, MAKEINTRESOURCE(IDI_TETRIS)));
-#pragma warning( default : 4311 )
-
-			SetDlgItemText(hWndDlg, IDC_HOFNAME1, hall_of_fame[0].name);
-			SetDlgItemText(hWndDlg, IDC_HOFNAME2, hall_of_fame[1].name);
-			SetDlgItemText(hWndDlg, IDC_HOFNAME3, hall_of_fame[2].name);
-	
-			ZeroMemory(szBuffer, STRING_BUFFER_SIZE);
-			_stprintf_s(szBuffer, STRING_BUFFER_SIZE, TEXT("%d"), hall_of_fame[0].score);
-			SetDlgItemText(hWndDlg, IDC_HOFSCORE1, szBuffer);
-
-			ZeroMemory(szBuffer, STRING_BUFFER_SIZE);
-			_stprintf_s(szBuffer, STRING_BUFFER_SIZE, TEXT("%d"), hall_of_fame[1].score);
-			SetDlgItemText(hWndDlg, IDC_HOFSCORE2, szBuffer);
-
-			ZeroMemory(szBuffer, STRING_BUFFER_SIZE);
-			_stprintf_s(szBuffer, STRING_BUFFER_SIZE, TEXT("%d"), hall_of_fame[2].score);
-			SetDlgItemText(hWndDlg, IDC_HOFSCORE3, szBuffer);
-			
-			return TRUE;
-		}
-    case WM_COMMAND:
-		{
-			switch (LOWORD(wParam)) 
-			{ 
-				case IDOK:
-					{
-						EndDialog(hWndDlg, wParam); 
-						return TRUE;
-					}
-			} 
-		}
-	} 
-
-    return FALSE; 
-} 
-
-BOOL CALLBACK OkDlgProc(HWND hWndDlg, UINT message, WPARAM wParam, LPARAM lParam) 
-{ 
-    switch (message) 
-    {
-		case WM_INITDIALOG:
-		{
-#pragma warning( disable : 4311 ) // 'type cast' : pointer truncation from 'HICON' to 'LONG'
-			SetClassLong(hWndDlg, GCL_HICON, (LONG) LoadIcon(g_hInstance, MAKEINTRESOURCE(IDI_TETRIS)));
-#pragma warning( default : 4311 )
-			return TRUE;
-		}
-        case WM_COMMAND:
-			{
-				switch (LOWORD(wParam)) 
-				{ 
-					case IDOK:
-						{
-							EndDialog(hWndDlg, wParam); 
-							return TRUE;
-						}
-				} 
-			}
-	} 
-
-    return FALSE; 
-} 
-
-BOOL validate_name(PTCHAR szBuffer)
-{
-	BOOL result = FALSE;
-
-	if (!szBuffer) 
-		return result;
-
-	size_t idx = 0;
-	size_t len = _tcslen(szBuffer);
-		
-	while (idx < len)
-	{
-		if (!_istspace(szBuffer[idx]))
-		{
-			result = TRUE;
-			break;			
-		}
-
-		idx++;
-	}
-
-	return result;
-}
-
-BOOL CALLBACK NameDlgProc(HWND hWndDlg, UINT message, WPARAM wParam, LPARAM lParam) 
-{ 
-    switch (message) 
-    { 
-	case WM_INITDIALOG:
-		{
-#pragma warning( disable : 4311 ) // 'type cast' : pointer truncation from 'HICON' to 'LONG'
-			SetClassLong(hWndDlg, GCL_HICON, (LONG) LoadIcon(g_hInstance, MAKEINTRESOURCE(IDI_TETRIS)));
-#pragma warning( default : 4311 )
-
-			if (GetDlgCtrlID((HWND) wParam) != IDC_NAME) 
-			{ 
-				SetFocus(GetDlgItem(hWndDlg, IDC_NAME)); 
-				return FALSE; 
-			}
-			
-			return TRUE;
-		}
-    case WM_COMMAND:
-		{
-			switch (LOWORD(wParam)) 
-			{ 
-				case IDOK:
-					{
-						ZeroMemory(szBuffer, STRING_BUFFER_SIZE);
-						GetDlgItemText(hWndDlg, IDC_NAME, szBuffer, SCORE_MAX_NAME);
-
-						if (!validate_name(szBuffer))
-						{
-							MessageBox(NULL, TEXT("Please enter your name."), TEXT("Tetris"), MB_OK);
-							return FALSE;
-						}
-
-						if (score > hall_of_fame[0].score)
-						{
-							hall_of_fame[2] = hall_of_fame[1];
-							hall_of_fame[1] = hall_of_fame[0];
-							_tcscpy_s(hall_of_fame[0].name, SCORE_MAX_NAME, szBuffer);
-							hall_of_fame[0].score = score;
-						}
-						else if (score > hall_of_fame[1].score)
-						{
-							hall_of_fame[2] = hall_of_fame[1];
-							_tcscpy_s(hall_of_fame[1].name, SCORE_MAX_NAME, szBuffer);
-							hall_of_fame[1].score = score;
-						}
-						else if (score > hall_of_fame[2].score)
-						{
-							_tcscpy_s(hall_of_fame[2].name, SCORE_MAX_NAME, szBuffer);
-							hall_of_fame[2].score = score;
-						}
-
-						write_hof();
-						EndDialog(hWndDlg, wParam); 
-						return TRUE;
-					}
-			} 
-		}
-	} 
-
-    return FALSE; 
-} 
-
-LRESULT CALLBACK WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
-{
-	static TIMECAPS tc;
-	static HFONT hFont;
-	static HGDIOBJ hPrevObject;
-
-	switch (Msg)
-	{
-	case WM_ACTIVATEAPP:
-		{
-			fActive = (BOOL) wParam;
-			return 0L;
-		}
-	case WM_KEYDOWN:
-		{
-			switch (wParam)
-			{
-			case VK_F1:
-				{
-					DialogBox(g_hInstance, MAKEINTRESOURCE(DLG_HELP), g_hWnd, (DLGPROC)OkDlgProc);
-					break;
-				}
-			case VK_F2:
-				{
-					DialogBox(g_hInstance, MAKEINTRESOURCE(DLG_HOF), g_hWnd, (DLGPROC)HOFDlgProc);
-					break;
-				}
-			case VK_F3:
-				{
-					DialogBox(g_hInstance, MAKEINTRESOURCE(DLG_ABOUT), g_hWnd, (DLGPROC)OkDlgProc);
-					break;
-				}
-			}
-			return 0L;
-		}
-	case WM_CREATE:
-		{			
-			szBuffer = new TCHAR[STRING_BUFFER_SIZE];
-			szLevel = new TCHAR[STRING_BUFFER_SIZE];
-			szRows = new TCHAR[STRING_BUFFER_SIZE];
-			szScore = new TCHAR[STRING_BUFFER_SIZE];
-
-			if (!szBuffer || !szLevel || !szRows || !szScore)
-			{				
-				return -1;
-			}
-
-			if (NULL != szLevel) 
-			{
-				ZeroMemory(szLevel, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-				_stprintf_s(szLevel, STRING_BUFFER_SIZE, TEXT("%0.6d"), 0);
-			}
-
-			if (NULL != szRows) 
-			{
-				ZeroMemory(szRows, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-				_stprintf_s(szRows, STRING_BUFFER_SIZE, TEXT("%0.6d"), 0);
-			}
-
-			if (NULL != szScore)
-			{
-				ZeroMemory(szScore, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-				_stprintf_s(szScore, STRING_BUFFER_SIZE, TEXT("%0.6d"), 0);
-			}
-
-			read_hof();
-
-			timeGetDevCaps(&tc, sizeof(TIMECAPS));
-			timeBeginPeriod(tc.wPeriodMin);
-			
-			srand(hash_time());
-
-			for (int i = 0; i < COLOR_COUNT; i++)
-			{
-				brush_index[i] = CreateSolidBrush(color_value[i]);
-			}
-
-			make_field(-BRICK_WIDTH, 0);
-
-			// call twice to prime piece creation
-			create_piece(&active_piece, &next_piece);
-			create_piece(&active_piece, &next_piece);
-
-			// create double buffer
-			{
-				HDC hdc = GetDC(hWnd);
-
-				hdcBuffer = CreateCompatibleDC(hdc);			
-				hbmBuffer = CreateCompatibleBitmap(hdc, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
-				SelectObject(hdcBuffer, hbmBuffer);
-
-				hdcBackground = CreateCompatibleDC(hdc);
-				hbmBackground = CreateCompatibleBitmap(hdc, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
-				SelectObject(hdcBackground, hbmBackground);
-
-				ReleaseDC(hWnd, hdc);
-			}
-
-			// basic layout
-			{
-				RECT r;
-				SetRect(&r, 0, 0, BRICK_WIDTH * (FIELD_WIDTH - 2), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
-				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
-				
-				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 2), 0, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
-				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(LTGRAY_BRUSH));
-				
-				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
-
-				hFont = CreateFont(-MulDiv(14, GetDeviceCaps(hdcBackground, LOGPIXELSY), 72), 0, 0, 0, 700, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_TT_ONLY_PRECIS, CLIP_DEFAULT_PRECIS, NONANTIALIASED_QUALITY, DEFAULT_PITCH, TEXT("Comic Sans MS"));
-				hPrevObject = SelectObject(hdcBackground, hFont);
-
-				SetBkMode(hdcBackground, TRANSPARENT);
-				SetTextColor(hdcBackground, RGB(255, 0, 0));
-			}
-
-			// next
-			{
-				RECT r;
-				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 1), BRICK_HEIGHT * 2, BRICK_WIDTH * (FIELD_WIDTH + 4), BRICK_HEIGHT * (7));
-				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
-				
-				InflateRect(&r, 2, 2);
-
-				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
-
-				SIZE s;
-				TCHAR szText[] = TEXT("Next");
-				
-				GetTextExtentPoint32(hdcBackground, szText, ARRAYSIZE(szText) - 1, &s);
-				TextOut(hdcBackground, (r.left + (r.right - r.left) / 2) - (s.cx / 2), r.top - s.cy, szText, static_cast<int>(_tcslen(szText)));
-			}
-
-			// level
-			{
-				RECT r;
-				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 1), BRICK_HEIGHT * 9, BRICK_WIDTH * (FIELD_WIDTH + 4), BRICK_HEIGHT * (11));
-				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
-				
-				InflateRect(&r, 2, 2);
-
-				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
-
-				SIZE s;
-				TCHAR szText[] = TEXT("Level");
-				
-				GetTextExtentPoint32(hdcBackground, szText, ARRAYSIZE(szText) - 1, &s);
-				TextOut(hdcBackground, (r.left + (r.right - r.left) / 2) - (s.cx / 2), r.top - s.cy, szText, static_cast<int>(_tcslen(szText)));
-			}
-			
-			// lines
-			{
-				RECT r;
-				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 1), BRICK_HEIGHT * 13, BRICK_WIDTH * (FIELD_WIDTH + 4), BRICK_HEIGHT * (15));
-				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
-				
-				InflateRect(&r, 2, 2);
-
-				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
-
-				SIZE s;
-				TCHAR szText[] = TEXT("Lines");
-				
-				GetTextExtentPoint32(hdcBackground, szText, ARRAYSIZE(szText) - 1, &s);
-				TextOut(hdcBackground, (r.left + (r.right - r.left) / 2) - (s.cx / 2), r.top - s.cy, szText, static_cast<int>(_tcslen(szText)));
-			}
-		
-			// score
-			{
-				RECT r;
-				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 1), BRICK_HEIGHT * 17, BRICK_WIDTH * (FIELD_WIDTH + 4), BRICK_HEIGHT * (19));
-				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
-				
-				InflateRect(&r, 2, 2);
-
-				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
-
-				SIZE s;
-				TCHAR szText[] = TEXT("Score");
-				
-				GetTextExtentPoint32(hdcBackground, szText, ARRAYSIZE(szText) - 1, &s);
-				TextOut(hdcBackground, (r.left + (r.right - r.left) / 2) - (s.cx / 2), r.top - s.cy, szText, static_cast<int>(_tcslen(szText)));
-			}
-
-			DeleteObject(hFont);
-			SelectObject(hdcBackground, hPrevObject);
-
-			hFont = CreateFont(-MulDiv(8, GetDeviceCaps(hdcBackground, LOGPIXELSY), 72), 0, 0, 0, 700, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_TT_ONLY_PRECIS, CLIP_DEFAULT_PRECIS, NONANTIALIASED_QUALITY, DEFAULT_PITCH, TEXT("Comic Sans MS"));
-			hPrevObject = SelectObject(hdcBackground, hFont);
-
-			{
-				RECT r;
-				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 2), BRICK_HEIGHT * 20 + 4, BRICK_WIDTH * (FIELD_WIDTH + 5), BRICK_HEIGHT * (28));
-
-				TCHAR szText[] = TEXT("F1 - Help\nF2 - Hall of Fame\nF3 - About\nSpace - Start\nESC - Exit");
-				SetTextColor(hdcBackground, RGB(0, 0, 255));
-				DrawText(hdcBackground, szText, ARRAYSIZE(szText) - 1, &r, DT_CENTER | DT_VCENTER | DT_WORDBREAK);
-			}
-
-			DeleteObject(hFont);
-			SelectObject(hdcBackground, hPrevObject);
-
-			hFont = CreateFont(-MulDiv(14, GetDeviceCaps(hdcBackground, LOGPIXELSY), 72), 0, 0, 0, 700, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_TT_ONLY_PRECIS, CLIP_DEFAULT_PRECIS, NONANTIALIASED_QUALITY, DEFAULT_PITCH, TEXT("Comic Sans MS"));
-			hPrevObject = SelectObject(hdcBuffer, hFont);
-
-			{
-				TCHAR szText[7] = TEXT("000000");
-				SIZE s;
-				GetTextExtentPoint32(hdcBuffer, szText, ARRAYSIZE(szText) - 1, &s);
-				text_offset_x = ((((BRICK_WIDTH * (FIELD_WIDTH + 4)) - (BRICK_WIDTH * (FIELD_WIDTH - 1))) - s.cx) / 2);
-				text_offset_y = (((BRICK_HEIGHT * 2) - s.cy) / 2);
-			}
-			
-			SetBkMode(hdcBuffer, TRANSPARENT);
-			SetTextColor(hdcBuffer, RGB(255, 255, 255));
-
-			return 0;
-		}
-	case WM_CLOSE:
-		{
-			if (MessageBox(hWnd, TEXT("Exit?"), TEXT("Tetris"), MB_YESNO) == IDYES)
-				DestroyWindow(hWnd);
-			
-			return 0;
-		}
-	case WM_PAINT:
-		{
-			PAINTSTRUCT ps;
-			BeginPaint(hWnd, &ps);
-			render_frame();
-			EndPaint(hWnd, &ps);
-			return 0L;
-		}
-	case WM_DESTROY:
-		{
-			delete szBuffer;			
-			delete szLevel;
-			delete szRows;
-			delete szScore;
-
-			szBuffer = NULL;
-			szLevel = NULL;
-			szRows = NULL;
-			szScore = NULL;
-
-			timeEndPeriod(tc.wPeriodMin);
-
-			for (int i = 0; i < COLOR_COUNT; i++)
-			{
-				DeleteObject(brush_index[i]);
-			}
-
-			DeleteObject(hFont);
-			SelectObject(hdcBackground, hPrevObject);
-			
-			DeleteObject(hbmBackground);
-			DeleteDC(hdcBackground);
-
-			DeleteObject(hbmBuffer);
-			DeleteDC(hdcBuffer);
-
-			PostQuitMessage(0);
-			return 0;
-		}
-	}
-	return DefWindowProc(hWnd, Msg, wParam, lParam);
-}
-
-int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd)
-{
-	static TCHAR szClassName[] = TEXT("DBEB2C8C-1BCD-409f-985E-276CB19A81B5");
-	static TCHAR szAppName[] = TEXT("Tetris");
-	WNDCLASSEX wcex;
-
-	HANDLE hMutex = CreateMutex(NULL, TRUE, szClassName);	
-	if (ERROR_ALREADY_EXISTS == GetLastError())
-	{
-		MessageBox(NULL, TEXT("Tetris is already running."), szAppName, MB_OK);
-		CloseHandle(hMutex);
-		return 0;
-	}
-
-	g_hInstance = hInstance;
-
-	wcex.cbClsExtra = 0;
-	wcex.cbSize = sizeof(WNDCLASSEX);
-	wcex.cbWndExtra = 0;
-	wcex.hbrBackground = NULL;
-	wcex.hCursor = LoadCursor(NULL, IDC_ARROW);
-	wcex.hIcon = LoadIcon(hInstance, MAKEINTRESOURCE(IDI_TETRIS));
-	wcex.hIconSm = NULL;
-	wcex.hInstance = hInstance;
-	wcex.lpfnWndProc = WndProc;
-	wcex.lpszClassName = szClassName;
-	wcex.lpszMenuName = NULL;
-	wcex.style = CS_OWNDC;
-
-	if (!RegisterClassEx(&wcex))
-		return 0;
-
-	DWORD dwStyle = WS_POPUP | WS_BORDER | WS_SYSMENU | WS_MINIMIZEBOX | WS_CAPTION;
-	DWORD dwExStyle = 0;
-
-	RECT r, w;
-	SetRect(&r, 0, 0, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
-	AdjustWindowRectEx(&r, dwStyle, FALSE, dwExStyle);
-	SystemParametersInfo(SPI_GETWORKAREA, 0, &w, 0);
-	int width = r.right - r.left;
-	int height = r.bottom - r.top;
-	int x = ((w.right - w.left) / 2) - (width / 2);
-	int y = ((w.bottom - w.top) / 2) - (height / 2);
-
-	g_hWnd = CreateWindowEx(dwExStyle, szClassName, szAppName, dwStyle, x, y, width, height, NULL, NULL, hInstance, 0);
-	if (!g_hWnd)
-		return 0;
-
-	g_hdc = GetDC(g_hWnd);
-
-	ShowWindow(g_hWnd, SW_NORMAL);
-	UpdateWindow(g_hWnd);
-
-	MSG msg;	
-	while (1)
-	{
-		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
-		{	
-			if (WM_QUIT == msg.message)
-				break;
-
-			TranslateMessage(&msg);
-			DispatchMessage(&msg);
-		}
-		else
-		{
-			if (fActive)
-			{
-				process_input();
-
-				current_time = timeGetTime();
-				
-				if (fStart)
-				{
-					if ((current_time - last_time) >= speed[level])
-					{
-						last_time = current_time;
-
-						erase_piece(&active_piece);	
-						fDropped = down_piece(&active_piece);
-						draw_piece(&active_piece);
-						
-						if (!fDropped)
-						{
-							full_rows = remove_full_rows();
-
-							switch (full_rows)
-							{
-							case 0: break;
-							case 1: score += 500; break;
-							case 2: score += 1000; break;
-							case 3: score += 1500; break;
-							case 4: score += 2000; break;
-							default: break;
-							}
-							
-							score += ((full_rows * level) + rows_per_level);
-
-							if (NULL != szScore)
-							{
-								ZeroMemory(szScore, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-								_stprintf_s(szScore, STRING_BUFFER_SIZE, TEXT("%0.6d"), score);
-							}
-
-							total_rows += full_rows;
-
-							if (NULL != szRows)
-							{
-								ZeroMemory(szRows, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-								_stprintf_s(szRows, STRING_BUFFER_SIZE, TEXT("%0.6d"), total_rows);
-							}
-
-							rows_per_level += full_rows;					
-							if (rows_per_level > 9)
-							{
-								rows_per_level = 0;
-								if (++level > 19)
-								{
-									level = 0;
-									for (int i = 0; i < 20; i++)
-									{
-										if ((speed[i] - 10) > 0)
-										{
-											speed[i] -= 10;
-										}
-										else
-										{
-											speed[i] = 0;
-										}
-									}
-								}
-
-								if (NULL != szLevel)
-								{
-									ZeroMemory(szLevel, sizeof(TCHAR) * STRING_BUFFER_SIZE);
-									_stprintf_s(szLevel, STRING_BUFFER_SIZE, TEXT("%0.6d"), level + 1);
-								}
-							}
-
-							erase_piece(&next_piece);
-							
-							create_piece(&active_piece, &next_piece);
-
-							if (!check_piece(&active_piece))
-							{
-								fStart = FALSE;
-								clear_field(WHITE);
-
-								if (score > hall_of_fame[2].score)
-								{
-									DialogBox(g_hInstance, MAKEINTRESOURCE(DLG_NAME), g_hWnd, (DLGPROC)NameDlgProc);
-									DialogBox(g_hInstance, MAKEINTRESOURCE(DLG_HOF), g_hWnd, (DLGPROC)HOFDlgProc);
-								}
-
-							}
-							else
-							{
-								draw_piece(&active_piece);
-								draw_piece(&next_piece);
-							}
-						}			
-					}
-				}
-				else
-				{
-					WaitMessage();
-				}
-			}
-		}
-
-		render_frame();
-	}
-
-	ReleaseMutex(hMutex);
-	CloseHandle(hMutex);
-
-	return (int) msg.wParam;
-}
+/******************************************************************************************/
+/*                                                                                        */
+/*  WinTris - Tetris For Windows														  */
+/*  Original: August 17, 2002                                                             */
+/*  Modified: May 18, 2008																  */
+/*  Dave Behnke                                                                           */
+/*                                                                                        */
+/******************************************************************************************/
+
+#ifdef _WIN32
+#define STRICT
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+
+#include <windows.h>
+#include <tchar.h>
+#include <mmsystem.h>
+#include <winsock2.h>
+#include "resource.h"
+
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#endif
+
+#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "TetrisBot.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RASTER_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define RASTER_NEON
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// the game rules, the bot and the software renderer build anywhere, only the window needs Win32
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef DWORD COLORREF;
+typedef int SOCKET;
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define _TRUNCATE ((size_t) -1)
+
+#define RGB(r, g, b) ((COLORREF) (((BYTE) (r)) | ((WORD) ((BYTE) (g)) << 8) | (((DWORD) (BYTE) (b)) << 16)))
+#define GetRValue(rgb) ((BYTE) (rgb))
+#define GetGValue(rgb) ((BYTE) ((rgb) >> 8))
+#define GetBValue(rgb) ((BYTE) ((rgb) >> 16))
+#define ZeroMemory(p, n) memset((p), 0, (n))
+#define sprintf_s snprintf
+#define INVALID_SOCKET (-1)
+#define closesocket close
+
+inline DWORD timeGetTime(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (DWORD) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+inline int fopen_s(FILE **file, const char *path, const char *mode)
+{
+	*file = fopen(path, mode);
+	return *file ? 0 : -1;
+}
+
+inline int strncpy_s(char *dest, size_t size, const char *src, size_t count)
+{
+	size_t length = strlen(src);
+	if (count != _TRUNCATE && count < length)
+		length = count;
+	if (length >= size)
+		length = size - 1;
+
+	memcpy(dest, src, length);
+	dest[length] = 0;
+	return 0;
+}
+#endif
+
+#ifdef _WIN32
+HDC g_hdc = NULL;
+HINSTANCE g_hInstance = NULL;
+HWND g_hWnd = NULL;
+
+HBITMAP hbmBuffer = NULL, hbmBackground = NULL;
+HDC hdcBuffer = NULL, hdcBackground = NULL;
+
+std::atomic<BOOL> fActive(FALSE), fDialog(FALSE), fSoftware(FALSE);
+std::atomic<bool> fRunning(false);
+
+PTCHAR szBuffer = NULL, szLevel = NULL, szRows = NULL, szScore = NULL;
+const int STRING_BUFFER_SIZE = 256;
+#endif
+
+std::atomic<BOOL> fDirty(FALSE);
+
+const int COLOR_COUNT = 10;
+
+// GHOST only appears in frames, never in the field
+enum color_type { RED = 0, ORANGE, YELLOW, GREEN, BLUE, WHITE, MAGENTA, BLACK, GRAY, GHOST };
+
+COLORREF color_value[COLOR_COUNT] = { RGB( 255, 0, 0 ), RGB( 255, 128, 0 ), RGB( 255, 255, 0 ), 
+									RGB( 0, 255, 0 ), RGB( 0, 0, 255 ), RGB( 255, 255, 255 ), RGB( 255, 0, 128 ), 									 
+									RGB( 0, 0, 0 ), RGB( 127, 127, 127), RGB( 48, 48, 48 ) };
+
+#ifdef _WIN32
+HBRUSH brush_index[COLOR_COUNT] = { 0 };
+
+int text_offset_x = 0, text_offset_y = 0;
+#endif
+
+const DWORD speed_table[20] = { 290, 285, 280, 275, 270, 265, 240, 215, 190, 165, 
+										160, 155, 150, 145, 140, 135, 125, 120, 115, 90 };
+
+// gravity is rows per millisecond of game time in 16.16 fixed point, so a fast level moves
+// several rows in one step and 20G - a speed of 0 - puts the piece on the stack at once.
+// a piece that falls onto the stack locks after LOCK_DELAY_MS, each move or turn on the ground
+// restarts the delay up to LOCK_RESETS times. a hard drop locks on the next gravity step
+const int GRAVITY_SHIFT = 16;
+const DWORD GRAVITY_ONE = 1 << GRAVITY_SHIFT;
+const DWORD GRAVITY_20G = 20 * GRAVITY_ONE;
+const DWORD LOCK_DELAY_MS = 500;
+const int LOCK_RESETS = 15;
+
+const int PIECE_COUNT = 7;
+
+const int INFO_WIDTH = 6;
+
+const int FIELD_WIDTH = 12;
+const int FIELD_HEIGHT = 28;
+
+const int BRICK_WIDTH = 16;
+const int BRICK_HEIGHT = 16;
+
+#ifdef _WIN32
+const int SCORE_MAX_NAME = 8;
+
+struct score_t
+{
+	TCHAR name[SCORE_MAX_NAME];
+	int score;
+};
+
+struct score_t hall_of_fame[3];
+#endif
+
+struct shape_t
+{
+	int count;
+	int shape[4];
+	enum color_type color;
+};
+
+struct shape_t shapes[7] = 
+{	  										  
+	{ 0x0001, 0xCC00, 0x0000, 0x0000, 0x0000, RED },
+	{ 0x0004, 0x4444, 0x0F00, 0x2222, 0x0F00, ORANGE },
+	{ 0x0004, 0x4E00, 0x4C40, 0x0E40, 0x4640, YELLOW },
+	{ 0x0004, 0x4460, 0x0E80, 0xC440, 0x2E00, GREEN },
+	{ 0x0004, 0x44C0, 0x8E00, 0x6440, 0x0E20, BLUE },
+	{ 0x0002, 0x4C80, 0xC600, 0x0000, 0x0000, WHITE },
+	{ 0x0002, 0x8C40, 0x6C00, 0x0000, 0x0000, MAGENTA }
+};
+
+struct piece_t
+{
+	int x, y;
+	int rotation;
+	int shape;
+};
+
+#ifdef _WIN32
+// screen position of every cell, the colors live in the game
+RECT field_rect[FIELD_HEIGHT][FIELD_WIDTH + INFO_WIDTH];
+#endif
+
+// counter based piece generator (Philox4x32-10) - piece k of a stream is a pure function of
+// seed, stream and k, so any game on any thread can jump straight to any piece
+enum piece_mode { PIECE_UNIFORM = 0, PIECE_BAG };
+
+struct piece_stream_t
+{
+	DWORD seed[2];
+	DWORD stream;
+	enum piece_mode mode;
+};
+
+const DWORD PHILOX_M0 = 0xD2511F53, PHILOX_M1 = 0xCD9E8D57;
+const DWORD PHILOX_W0 = 0x9E3779B9, PHILOX_W1 = 0xBB67AE85;
+
+// counter domains keep shape, bag and rotation draws independent of each other
+const DWORD DOMAIN_UNIFORM = 0x00000000, DOMAIN_BAG = 0x40000000, DOMAIN_ROTATION = 0x80000000;
+const DWORD DOMAIN_GARBAGE = 0x10000000;
+
+void philox4x32(const DWORD counter[4], const DWORD seed[2], DWORD out[4])
+{
+	DWORD c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	DWORD k0 = seed[0], k1 = seed[1];
+
+	for (int round = 0; round < 10; round++)
+	{
+		ULONGLONG p0 = (ULONGLONG) PHILOX_M0 * c0;
+		ULONGLONG p1 = (ULONGLONG) PHILOX_M1 * c2;
+
+		c0 = (DWORD) (p1 >> 32) ^ c1 ^ k0;
+		c1 = (DWORD) p1;
+		c2 = (DWORD) (p0 >> 32) ^ c3 ^ k1;
+		c3 = (DWORD) p0;
+
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+
+	out[0] = c0, out[1] = c1, out[2] = c2, out[3] = c3;
+}
+
+// endless supply of words for one counter - block n of the supply is counter word 3 = domain | n
+struct philox_words_t
+{
+	DWORD counter[4];
+	const DWORD *seed;
+	DWORD block[4];
+	int used;
+};
+
+void philox_words_init(struct philox_words_t *words, const struct piece_stream_t *stream, ULONGLONG index, DWORD domain)
+{
+	words->counter[0] = (DWORD) index;
+	words->counter[1] = (DWORD) (index >> 32);
+	words->counter[2] = stream->stream;
+	words->counter[3] = domain;
+	words->seed = stream->seed;
+	words->used = 4;
+}
+
+DWORD philox_next(struct philox_words_t *words)
+{
+	if (words->used == 4)
+	{
+		philox4x32(words->counter, words->seed, words->block);
+		words->counter[3]++;
+		words->used = 0;
+	}
+
+	return words->block[words->used++];
+}
+
+// unbiased value in [0, n) - multiply and reject the few low products that would favour small values
+DWORD philox_below(struct philox_words_t *words, DWORD n)
+{
+	DWORD threshold = (0U - n) % n;
+
+	for (;;)
+	{
+		ULONGLONG product = (ULONGLONG) philox_next(words) * n;
+
+		if ((DWORD) product >= threshold)
+			return (DWORD) (product >> 32);
+	}
+}
+
+void piece_stream_init(struct piece_stream_t *stream, ULONGLONG seed, DWORD id, enum piece_mode mode)
+{
+	stream->seed[0] = (DWORD) seed;
+	stream->seed[1] = (DWORD) (seed >> 32);
+	stream->stream = id;
+	stream->mode = mode;
+}
+
+// shape and rotation of piece number index in O(1)
+void piece_at(const struct piece_stream_t *stream, ULONGLONG index, struct piece_t *piece)
+{
+	struct philox_words_t words;
+
+	if (stream->mode == PIECE_BAG)
+	{
+		int bag[PIECE_COUNT];
+		for (int i = 0; i < PIECE_COUNT; i++)
+			bag[i] = i;
+
+		// shuffle of the whole bag this piece belongs to, only the slots up to ours are needed
+		int slot = (int) (index % PIECE_COUNT);
+		philox_words_init(&words, stream, index / PIECE_COUNT, DOMAIN_BAG);
+
+		for (int i = 0; i <= slot && i < PIECE_COUNT - 1; i++)
+		{
+			int j = i + (int) philox_below(&words, PIECE_COUNT - i);
+			int swap = bag[i];
+			bag[i] = bag[j];
+			bag[j] = swap;
+		}
+
+		piece->shape = bag[slot];
+	}
+	else
+	{
+		philox_words_init(&words, stream, index, DOMAIN_UNIFORM);
+		piece->shape = (int) philox_below(&words, PIECE_COUNT);
+	}
+
+	philox_words_init(&words, stream, index, DOMAIN_ROTATION);
+	piece->rotation = (int) philox_below(&words, shapes[piece->shape].count);
+}
+
+// features of the locked stack, kept current on lock and clear so evaluators read them
+// instead of scanning the field. bit k of a column mask is the cell k rows above the floor,
+// which turns height into a bit scan, holes into a popcount and a cleared row into a shift
+struct board_features_t
+{
+	DWORD columns[FIELD_WIDTH];
+	BYTE heights[FIELD_WIDTH];
+	BYTE holes[FIELD_WIDTH];
+	BYTE fill[FIELD_HEIGHT];	// indexed like field rows
+	int cells;
+	int aggregate_height, total_holes;
+};
+
+inline int bit_count(DWORD bits)
+{
+#ifdef _MSC_VER
+	return (int) __popcnt(bits);
+#else
+	return __builtin_popcount(bits);
+#endif
+}
+
+// index of the highest set bit plus one, 0 for no bits
+inline int bit_length(DWORD bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanReverse(&index, bits) ? (int) index + 1 : 0;
+#else
+	return bits ? 32 - __builtin_clz(bits) : 0;
+#endif
+}
+
+inline void features_column(struct board_features_t *features, int col)
+{
+	int height = bit_length(features->columns[col]);
+	int holes = height - bit_count(features->columns[col]);
+
+	features->aggregate_height += height - features->heights[col];
+	features->total_holes += holes - features->holes[col];
+	features->heights[col] = (BYTE) height;
+	features->holes[col] = (BYTE) holes;
+}
+
+void features_lock(struct board_features_t *features, const struct piece_t *piece)
+{
+	for (int row = 0; row < 4; row++)
+	{
+		int y = piece->y + row;
+
+		for (int col = 0; col < 4; col++)
+		{
+			if (!(shapes[piece->shape].shape[piece->rotation] & (0x8000 >> (row * 4 + col))))
+				continue;
+
+			int x = piece->x + col;
+			features->columns[x] |= 1U << (FIELD_HEIGHT - 2 - y);
+			features->fill[y]++;
+			features->cells++;
+			features_column(features, x);
+		}
+	}
+}
+
+// the rows above move down one, like remove_row does to the field
+void features_remove_row(struct board_features_t *features, int row)
+{
+	int level = FIELD_HEIGHT - 2 - row;
+	DWORD below = (1U << level) - 1;
+
+	for (int col = 1; col < FIELD_WIDTH - 1; col++)
+	{
+		DWORD bits = features->columns[col];
+		features->columns[col] = (bits & below) | ((bits >> (level + 1)) << level);
+		features_column(features, col);
+	}
+
+	features->cells -= features->fill[row];
+	memmove(features->fill + 1, features->fill, row);
+	features->fill[0] = 0;
+}
+
+// rows full but for the hole column rise from the floor
+void features_add_garbage(struct board_features_t *features, int rows, int hole)
+{
+	DWORD garbage = (1U << rows) - 1;
+
+	for (int col = 1; col < FIELD_WIDTH - 1; col++)
+	{
+		features->columns[col] = (features->columns[col] << rows) | ((col != hole) ? garbage : 0);
+		features_column(features, col);
+	}
+
+	memmove(features->fill, features->fill + rows, FIELD_HEIGHT - 1 - rows);
+	for (int row = FIELD_HEIGHT - 1 - rows; row < FIELD_HEIGHT - 1; row++)
+		features->fill[row] = FIELD_WIDTH - 3;
+
+	features->cells += rows * (FIELD_WIDTH - 3);
+}
+
+// rows a piece can fall from y before it rests on the stack given as column masks. a column
+// of the piece only meets the highest locked cell below its own lowest cell, found with one
+// bit scan, so the answer matches stepping down a row at a time even under overhangs
+inline int column_drop(const DWORD columns[FIELD_WIDTH], int shape, int rotation, int x, int y)
+{
+	int bits = shapes[shape].shape[rotation];
+	int distance = FIELD_HEIGHT;
+
+	for (int col = 0; col < 4; col++)
+	{
+		// bit 15 - 4 * row - col of the shape is the cell at row, col of the 4x4 grid
+		DWORD cells = bits & (0x8888 >> col);
+		if (!cells)
+			continue;
+
+		int bottom = y + (15 - col - (bit_length(cells & (0U - cells)) - 1)) / 4;
+		int level = FIELD_HEIGHT - 2 - bottom;
+
+		// the floor is level -1, so an empty column lets the cell reach level 0
+		int rest = bit_length(columns[x + col] & ((1U << level) - 1));
+		if (level - rest < distance)
+			distance = level - rest;
+	}
+
+	return distance;
+}
+
+// everything the rules need - plain data, so a game can be copied, stored in a replay
+// and simulated away from the window
+struct game_t
+{
+	BYTE field[FIELD_HEIGHT][FIELD_WIDTH + INFO_WIDTH];
+	struct piece_t active_piece, next_piece;
+	int level, rows_per_level, full_rows, total_rows, score;
+	DWORD speed[20];
+	struct piece_stream_t stream;
+	ULONGLONG piece_index;
+	DWORD tick;
+	WORD number;
+	BOOL fStart;
+	BOOL fTelemetry;
+	struct board_features_t features;
+	int garbage_pending, garbage_sent;	// versus rows waiting to rise, rows owed to the opponent
+	ULONGLONG garbage_index;
+	DWORD gravity, fall;		// 16.16 rows per millisecond, fraction of a row fallen so far
+	DWORD gravity_tick;			// game time gravity was last applied
+	DWORD lock_tick;			// game time the piece came to rest
+	int lock_resets;
+	BOOL fGrounded;
+};
+
+struct game_t game;
+
+void create_piece(struct game_t *game)
+{
+	struct piece_t *active_piece = &game->active_piece, *next_piece = &game->next_piece;
+
+	active_piece->rotation = next_piece->rotation;
+	active_piece->shape = next_piece->shape;
+	active_piece->x = 4;
+	active_piece->y = 0;
+
+	piece_at(&game->stream, game->piece_index++, next_piece);
+	next_piece->x = 13;
+	next_piece->y = 3;
+
+	game->fall = 0;
+	game->gravity_tick = game->tick;
+	game->lock_resets = 0;
+	game->fGrounded = FALSE;
+}
+
+// return TRUE if move is possible, FALSE if impossible
+inline BOOL check_piece(const struct game_t *game, const struct piece_t *piece)
+{
+	int row = 0, col = 0;
+	
+	for (int bit = 0x8000; bit >= 0x0001; bit >>= 1)
+	{
+		if (shapes[piece->shape].shape[piece->rotation] & bit) {
+			if (game->field[piece->y + row][piece->x + col] != BLACK) {
+				return FALSE;		
+			}
+		}
+
+		col++;
+		if (col == 4) {
+			row++;
+			col = 0;
+		}
+	}
+
+	return TRUE;
+}
+
+// after the piece moved - at 20G it falls straight onto the stack, and a piece that
+// came to rest starts its lock delay while one moved along the stack restarts it
+void settle_piece(struct game_t *game, struct piece_t *piece)
+{
+	int distance = column_drop(game->features.columns, piece->shape, piece->rotation, piece->x, piece->y);
+
+	if (distance && game->gravity >= GRAVITY_20G)
+		piece->y += distance, distance = 0;
+
+	if (distance)
+	{
+		// off the edge of the stack - it falls from here, not from when it landed
+		if (game->fGrounded)
+		{
+			game->fGrounded = FALSE;
+			game->gravity_tick = game->tick;
+			game->fall = 0;
+		}
+	}
+	else if (!game->fGrounded)
+	{
+		game->fGrounded = TRUE;
+		game->lock_tick = game->tick;
+	}
+	else if (game->lock_resets < LOCK_RESETS)
+	{
+		game->lock_resets++;
+		game->lock_tick = game->tick;
+	}
+}
+
+void rotate_piece(struct game_t *game, struct piece_t *piece)
+{
+	int previous_rotation = piece->rotation;
+
+	piece->rotation++;
+	if (piece->rotation == shapes[piece->shape].count)
+		piece->rotation = 0;
+
+	if (!check_piece(game, piece))
+		piece->rotation = previous_rotation;
+	else
+		settle_piece(game, piece);
+}
+
+void stamp_piece(BYTE field[FIELD_HEIGHT][FIELD_WIDTH + INFO_WIDTH], const struct piece_t *piece, BYTE color)
+{
+	int col = 0, row = 0;
+	
+	for (int bit = 0x8000; bit >= 0x0001; bit >>= 1)
+	{
+		if (shapes[piece->shape].shape[piece->rotation] & bit) {
+			field[piece->y + row][piece->x + col] = color;
+		}
+
+		col++;
+		if (col == 4) {
+			row++;
+			col = 0;
+		}
+	}
+}
+
+// the field only ever holds the locked stack - a piece is written into it when it locks,
+// the falling piece, the preview and the ghost are composited over a copy by frame_fill
+void draw_piece(struct game_t *game, const struct piece_t *piece)
+{
+	stamp_piece(game->field, piece, (BYTE) shapes[piece->shape].color);
+}
+
+void left_piece(struct game_t *game, struct piece_t *piece)
+{
+	--piece->x;
+
+	if (!check_piece(game, piece))
+		++piece->x;
+	else
+		settle_piece(game, piece);
+}
+
+void right_piece(struct game_t *game, struct piece_t *piece)
+{
+	++piece->x;
+
+	if (!check_piece(game, piece))
+		--piece->x;
+	else
+		settle_piece(game, piece);
+}
+
+// a hard drop takes no lock delay - the piece locks on the next gravity step and moves
+// made before then don't restart the delay
+int drop_piece(struct game_t *game, struct piece_t *piece)
+{
+	int distance = column_drop(game->features.columns, piece->shape, piece->rotation, piece->x, piece->y);
+
+	piece->y += distance;
+	game->fGrounded = TRUE;
+	game->lock_tick = game->tick - LOCK_DELAY_MS;
+	game->lock_resets = LOCK_RESETS;
+
+	return distance;
+}
+
+// gravity of the current level, speed[] holds milliseconds per row - rounded up so a row
+// takes exactly that long
+void game_speed(struct game_t *game)
+{
+	DWORD ms = game->speed[game->level];
+	game->gravity = ms ? (GRAVITY_ONE + ms - 1) / ms : GRAVITY_20G;
+}
+
+// game time of the next thing gravity will do, a row down or the lock - the loop that
+// drives a game only has to step it then, however fast it falls
+DWORD game_gravity_due(const struct game_t *game)
+{
+	if (game->fGrounded)
+		return game->lock_tick + LOCK_DELAY_MS;
+
+	return game->gravity_tick + (GRAVITY_ONE - game->fall + game->gravity - 1) / game->gravity;
+}
+
+int next_full_row(const struct game_t *game)
+{
+	int count;
+
+	for (int row = FIELD_HEIGHT - 2; row > 0; row--)
+	{
+		count = 0;
+
+		for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		{
+			if (game->field[row][col] != BLACK)
+				count++;
+		}
+
+		if (count == FIELD_WIDTH - 2)
+			return row;
+	}
+
+	return -1;
+}
+
+void remove_row(struct game_t *game, int row)
+{
+	for (int j = row; j > 0; j--)
+	{
+		for (int k = 0; k < FIELD_WIDTH; k++)
+		{
+			game->field[j][k] = game->field[j - 1][k];
+		}
+	}
+
+	// the top row comes in empty, as in board_lock and features_remove_row
+	for (int k = 1; k < FIELD_WIDTH - 1; k++)
+		game->field[0][k] = BLACK;
+
+	features_remove_row(&game->features, row);
+}
+
+int remove_full_rows(struct game_t *game)
+{
+	int count = 0;
+	int row = -1;
+	
+	while ((row = next_full_row(game)) != -1)
+	{
+		remove_row(game, row);
+		count++;
+	}
+
+	return count;
+}
+
+// pushes the stack up by rows of garbage sharing one hole, FALSE if the stack would be
+// pushed out of the top of the field
+BOOL add_garbage(struct game_t *game, int rows)
+{
+	if (rows > FIELD_HEIGHT - 1)
+		rows = FIELD_HEIGHT - 1;
+
+	BOOL fFits = TRUE;
+	for (int row = 0; row < rows; row++)
+	{
+		for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		{
+			if (game->field[row][col] != BLACK)
+				fFits = FALSE;
+		}
+	}
+
+	struct philox_words_t words;
+	philox_words_init(&words, &game->stream, game->garbage_index++, DOMAIN_GARBAGE);
+	int hole = 1 + (int) philox_below(&words, FIELD_WIDTH - 2);
+
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+	{
+		for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		{
+			if (row < FIELD_HEIGHT - 1 - rows)
+				game->field[row][col] = game->field[row + rows][col];
+			else
+				game->field[row][col] = (col == hole) ? BLACK : GRAY;
+		}
+	}
+
+	features_add_garbage(&game->features, rows, hole);
+	return fFits;
+}
+
+#ifdef _WIN32
+void make_field(int x, int y)
+{
+	for (int row = 0; row < FIELD_HEIGHT; row++)
+	{
+		for (int col = 0; col < FIELD_WIDTH + INFO_WIDTH; col++)
+		{
+			SetRect(&field_rect[row][col], x + (BRICK_WIDTH * col) + 1, y + (BRICK_HEIGHT * row) + 1, 
+					x + (BRICK_WIDTH * col + BRICK_WIDTH) - 1, y + (BRICK_HEIGHT * row + BRICK_HEIGHT) - 1);
+		}
+	}
+}
+#endif
+
+void clear_field(struct game_t *game, enum color_type color)
+{
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+	{
+		for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		{
+			game->field[row][col] = (BYTE) color;
+		}
+	}
+}
+
+// walls, empty well and preview box, then two pieces to prime piece creation
+void game_init(struct game_t *game, const struct piece_stream_t *stream)
+{
+	ZeroMemory(game, sizeof(struct game_t));
+
+	for (int row = 0; row < FIELD_HEIGHT; row++)
+	{
+		for (int col = 0; col < FIELD_WIDTH + INFO_WIDTH; col++)
+		{
+			if (col == 0 || col >= FIELD_WIDTH - 1 || row == FIELD_HEIGHT - 1)
+				game->field[row][col] = GRAY;
+			else
+				game->field[row][col] = BLACK;
+		}
+	}
+
+	for (int row = 2; row < 7; row++)
+	{
+		for (int col = 12; col < 17; col++)
+		{
+			game->field[row][col] = BLACK;
+		}
+	}
+
+	for (int i = 0; i < 20; i++)
+		game->speed[i] = speed_table[i];
+
+	game->stream = *stream;
+
+	create_piece(game);
+	create_piece(game);
+}
+
+// compact copy of the playfield used by the bot - bit n of a row is column n, the walls,
+// the unused high bits and the floor row are always set so they block like GRAY bricks
+struct board_t
+{
+	WORD rows[FIELD_HEIGHT];
+};
+
+const WORD BOARD_EMPTY_ROW = 0xF801;
+const WORD BOARD_FULL_ROW = 0xFFFF;
+
+const WORD reverse_nibble[16] = { 0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE, 0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF };
+
+// one row of a shape with bit n set for column n of the 4x4 grid
+inline WORD shape_row(int shape, int rotation, int row)
+{
+	return reverse_nibble[(shapes[shape].shape[rotation] >> (12 - 4 * row)) & 0x000F];
+}
+
+// the field holds the locked stack only, so this is safe at any time
+void board_from_field(const struct game_t *game, struct board_t *board)
+{
+	for (int row = 0; row < FIELD_HEIGHT; row++)
+	{
+		WORD mask = BOARD_EMPTY_ROW;
+
+		for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		{
+			if (game->field[row][col] != BLACK)
+				mask |= 1 << col;
+		}
+
+		board->rows[row] = (row == FIELD_HEIGHT - 1) ? BOARD_FULL_ROW : mask;
+	}
+}
+
+// column masks of a board laid out like board_features_t, bit k is the cell k rows above the floor
+void board_columns(const struct board_t *board, DWORD columns[FIELD_WIDTH])
+{
+	memset(columns, 0, FIELD_WIDTH * sizeof(DWORD));
+
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+	{
+		for (DWORD bits = board->rows[row] & ~BOARD_EMPTY_ROW; bits; bits &= bits - 1)
+			columns[bit_length(bits & (0U - bits)) - 1] |= 1U << (FIELD_HEIGHT - 2 - row);
+	}
+}
+
+// FNV-1a over the rows, identifies a board in the telemetry
+DWORD board_hash(const struct board_t *board)
+{
+	DWORD hash = 0x811C9DC5;
+
+	for (int row = 0; row < FIELD_HEIGHT; row++)
+	{
+		hash = (hash ^ (board->rows[row] & 0xFF)) * 0x01000193;
+		hash = (hash ^ (board->rows[row] >> 8)) * 0x01000193;
+	}
+
+	return hash;
+}
+
+// same answer as check_piece - x may only be negative while the shape's own empty
+// columns are the ones pushed off the left edge
+inline BOOL board_fits(const struct board_t *board, int shape, int rotation, int x, int y)
+{
+	for (int row = 0; row < 4; row++)
+	{
+		WORD mask = shape_row(shape, rotation, row);
+
+		if (!mask)
+			continue;
+
+		if (y + row >= FIELD_HEIGHT)
+			return FALSE;
+
+		mask = (x >= 0) ? (WORD) (mask << x) : (WORD) (mask >> -x);
+		if (board->rows[y + row] & mask)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+// landing row of a piece dropped from the spawn row, -1 if it cannot spawn there - columns
+// from board_columns, built once per board and shared by all of its drops
+int board_drop(const struct board_t *board, const DWORD columns[FIELD_WIDTH], int shape, int rotation, int x)
+{
+	if (!board_fits(board, shape, rotation, x, 0))
+		return -1;
+
+	return column_drop(columns, shape, rotation, x, 0);
+}
+
+// locks the piece into the board and returns the number of rows removed
+int board_lock(struct board_t *board, int shape, int rotation, int x, int y)
+{
+	int count = 0;
+
+	for (int row = 0; row < 4; row++)
+	{
+		WORD mask = shape_row(shape, rotation, row);
+
+		if (mask)
+			board->rows[y + row] |= (x >= 0) ? (WORD) (mask << x) : (WORD) (mask >> -x);
+	}
+
+	for (int row = FIELD_HEIGHT - 2; row >= 0; )
+	{
+		if (board->rows[row] == BOARD_FULL_ROW)
+		{
+			for (int j = row; j > 0; j--)
+				board->rows[j] = board->rows[j - 1];
+
+			board->rows[0] = BOARD_EMPTY_ROW;
+			count++;
+		}
+		else
+		{
+			row--;
+		}
+	}
+
+	return count;
+}
+
+// leftmost and rightmost used column of a rotation within the 4x4 grid
+void shape_columns(int shape, int rotation, int *first, int *last)
+{
+	WORD mask = 0;
+
+	for (int row = 0; row < 4; row++)
+		mask |= shape_row(shape, rotation, row);
+
+	*first = 0;
+	while (!(mask & (1 << *first)))
+		(*first)++;
+
+	*last = 3;
+	while (!(mask & (1 << *last)))
+		(*last)--;
+}
+
+int column_height(const struct board_t *board, int col)
+{
+	int row = 0;
+
+	while (row < FIELD_HEIGHT - 1 && !(board->rows[row] & (1 << col)))
+		row++;
+
+	return FIELD_HEIGHT - 1 - row;
+}
+
+struct eval_weights_t
+{
+	double height;
+	double lines;
+	double holes;
+	double bumpiness;
+};
+
+struct eval_weights_t default_weights = { -0.510066, 0.760666, -0.35663, -0.184483 };
+
+double evaluate_board(const struct board_t *board, int lines, const struct eval_weights_t *weights)
+{
+	int heights[FIELD_WIDTH] = { 0 };
+	int aggregate = 0, holes = 0, bumpiness = 0;
+
+	for (int col = 1; col < FIELD_WIDTH - 1; col++)
+	{
+		heights[col] = column_height(board, col);
+		aggregate += heights[col];
+
+		for (int row = FIELD_HEIGHT - 1 - heights[col]; row < FIELD_HEIGHT - 1; row++)
+		{
+			if (!(board->rows[row] & (1 << col)))
+				holes++;
+		}
+	}
+
+	for (int col = 1; col < FIELD_WIDTH - 2; col++)
+		bumpiness += abs(heights[col] - heights[col + 1]);
+
+	return weights->height * aggregate + weights->lines * lines + weights->holes * holes + weights->bumpiness * bumpiness;
+}
+
+// evaluate_board from the maintained features, O(columns) instead of a scan of the field or board
+double evaluate_features(const struct board_features_t *features, int lines, const struct eval_weights_t *weights)
+{
+	int bumpiness = 0;
+
+	for (int col = 1; col < FIELD_WIDTH - 2; col++)
+		bumpiness += abs(features->heights[col] - features->heights[col + 1]);
+
+	return weights->height * features->aggregate_height + weights->lines * lines + weights->holes * features->total_holes + weights->bumpiness * bumpiness;
+}
+
+// features of a board, from its column masks
+void features_from_board(const struct board_t *board, const DWORD columns[FIELD_WIDTH], struct board_features_t *features)
+{
+	ZeroMemory(features, sizeof(struct board_features_t));
+	memcpy(features->columns, columns, sizeof(features->columns));
+
+	for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		features_column(features, col);
+
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+	{
+		features->fill[row] = (BYTE) bit_count(board->rows[row] & ~BOARD_EMPTY_ROW);
+		features->cells += features->fill[row];
+	}
+}
+
+struct placement_t
+{
+	int rotation;
+	int x, y;
+	double value;
+};
+
+const double PLACEMENT_LOST = -1.0e9;
+
+// best placement of one piece, value is PLACEMENT_LOST when nothing fits
+void best_single_placement(const struct board_t *board, int shape, const struct eval_weights_t *weights, struct placement_t *best)
+{
+	best->rotation = 0, best->x = 4, best->y = 0;
+	best->value = PLACEMENT_LOST;
+
+	DWORD columns[FIELD_WIDTH];
+	board_columns(board, columns);
+
+	// each placement updates a copy of the board's features, only its own columns and rows
+	struct board_features_t features;
+	features_from_board(board, columns, &features);
+
+	for (int rotation = 0; rotation < shapes[shape].count; rotation++)
+	{
+		int first, last;
+		shape_columns(shape, rotation, &first, &last);
+
+		for (int x = 1 - first; x + last < FIELD_WIDTH - 1; x++)
+		{
+			int y = board_drop(board, columns, shape, rotation, x);
+			if (y < 0)
+				continue;
+
+			struct board_features_t next = features;
+			struct piece_t piece = { x, y, rotation, shape };
+			int lines = 0;
+
+			features_lock(&next, &piece);
+			for (int row = y; row < y + 4 && row < FIELD_HEIGHT - 1; row++)
+			{
+				if (next.fill[row] == FIELD_WIDTH - 2)
+					features_remove_row(&next, row), lines++;
+			}
+
+			double value = evaluate_features(&next, lines, weights);
+
+			if (value > best->value)
+			{
+				best->rotation = rotation, best->x = x, best->y = y;
+				best->value = value;
+			}
+		}
+	}
+}
+
+// full evaluator - every placement of the active piece scored by the best follow up of the next piece
+BOOL evaluate_placements(const struct board_t *board, int shape, int next_shape, const struct eval_weights_t *weights, struct placement_t *best)
+{
+	best->rotation = 0, best->x = 4, best->y = 0;
+	best->value = PLACEMENT_LOST;
+
+	BOOL found = FALSE;
+
+	DWORD columns[FIELD_WIDTH];
+	board_columns(board, columns);
+
+	for (int rotation = 0; rotation < shapes[shape].count; rotation++)
+	{
+		int first, last;
+		shape_columns(shape, rotation, &first, &last);
+
+		for (int x = 1 - first; x + last < FIELD_WIDTH - 1; x++)
+		{
+			int y = board_drop(board, columns, shape, rotation, x);
+			if (y < 0)
+				continue;
+
+			struct board_t next = *board;
+			board_lock(&next, shape, rotation, x, y);
+
+			struct placement_t follow;
+			best_single_placement(&next, next_shape, weights, &follow);
+
+			if (!found || follow.value > best->value)
+			{
+				best->rotation = rotation, best->x = x, best->y = y;
+				best->value = follow.value;
+				found = TRUE;
+			}
+		}
+	}
+
+	return found;
+}
+
+// batched collision - many boards kept as a structure of arrays, rows[r][b] is row r of board b,
+// so one placement is tested against a block of boards with a handful of wide loads, ANDs and
+// ORs per piece row. the widest unit the compiler targets is used (AVX-512BW, AVX2, SSE2 or
+// NEON, scalar otherwise) and the answer is a bitmask with bit b set when the piece fits board b
+#if defined(__AVX512BW__)
+#include <immintrin.h>
+#define BATCH_AVX512
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define BATCH_AVX2
+#endif
+
+#if defined(BATCH_AVX512)
+#define BATCH_UNIT "AVX-512"
+#elif defined(BATCH_AVX2)
+#define BATCH_UNIT "AVX2"
+#elif defined(RASTER_SSE2)
+#define BATCH_UNIT "SSE2"
+#elif defined(RASTER_NEON)
+#define BATCH_UNIT "NEON"
+#else
+#define BATCH_UNIT "scalar"
+#endif
+
+const int BATCH_BLOCK = 32;		// boards per kernel pass, one DWORD of result
+
+struct board_batch_t
+{
+	WORD *rows[FIELD_HEIGHT];
+	int count, capacity;
+	BYTE *memory;
+};
+
+void board_batch_create(struct board_batch_t *batch, int capacity)
+{
+	batch->capacity = (capacity + BATCH_BLOCK - 1) / BATCH_BLOCK * BATCH_BLOCK;
+	batch->count = 0;
+	batch->memory = new BYTE[(size_t) FIELD_HEIGHT * batch->capacity * sizeof(WORD) + 64];
+
+	WORD *base = (WORD *) (((size_t) batch->memory + 63) & ~(size_t) 63);
+	for (int row = 0; row < FIELD_HEIGHT; row++)
+	{
+		batch->rows[row] = base + (size_t) row * batch->capacity;
+
+		// unused slots hold full rows, nothing fits them
+		for (int b = 0; b < batch->capacity; b++)
+			batch->rows[row][b] = BOARD_FULL_ROW;
+	}
+}
+
+void board_batch_destroy(struct board_batch_t *batch)
+{
+	delete [] batch->memory;
+	batch->memory = NULL;
+}
+
+void board_batch_set(struct board_batch_t *batch, int index, const struct board_t *board)
+{
+	for (int row = 0; row < FIELD_HEIGHT; row++)
+		batch->rows[row][index] = board->rows[row];
+
+	if (index >= batch->count)
+		batch->count = index + 1;
+}
+
+// the four row masks of a placement shifted to x, FALSE if a used row falls below the field
+inline BOOL placement_masks(int shape, int rotation, int x, int y, WORD masks[4])
+{
+	for (int row = 0; row < 4; row++)
+	{
+		WORD mask = shape_row(shape, rotation, row);
+		masks[row] = (x >= 0) ? (WORD) (mask << x) : (WORD) (mask >> -x);
+
+		if (masks[row] && (y + row < 0 || y + row >= FIELD_HEIGHT))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+inline DWORD batch_block_fits_scalar(const struct board_batch_t *batch, const WORD masks[4], int y, int first)
+{
+	DWORD result = 0;
+
+	for (int b = 0; b < BATCH_BLOCK; b++)
+	{
+		WORD hits = 0;
+		for (int row = 0; row < 4; row++)
+		{
+			if (masks[row])
+				hits |= batch->rows[y + row][first + b] & masks[row];
+		}
+
+		if (!hits)
+			result |= 1U << b;
+	}
+
+	return result;
+}
+
+// one placement against boards first to first + BATCH_BLOCK - 1
+inline DWORD batch_block_fits(const struct board_batch_t *batch, const WORD masks[4], int y, int first)
+{
+#if defined(BATCH_AVX512)
+	__m512i hits = _mm512_setzero_si512();
+
+	for (int row = 0; row < 4; row++)
+	{
+		if (masks[row])
+			hits = _mm512_or_si512(hits, _mm512_and_si512(_mm512_load_si512((const void *) (batch->rows[y + row] + first)), _mm512_set1_epi16((short) masks[row])));
+	}
+
+	return (DWORD) _mm512_testn_epi16_mask(hits, hits);
+#elif defined(BATCH_AVX2)
+	__m256i low = _mm256_setzero_si256(), high = _mm256_setzero_si256();
+
+	for (int row = 0; row < 4; row++)
+	{
+		if (!masks[row])
+			continue;
+
+		__m256i mask = _mm256_set1_epi16((short) masks[row]);
+		const __m256i *source = (const __m256i *) (batch->rows[y + row] + first);
+		low = _mm256_or_si256(low, _mm256_and_si256(_mm256_load_si256(source), mask));
+		high = _mm256_or_si256(high, _mm256_and_si256(_mm256_load_si256(source + 1), mask));
+	}
+
+	// equal to zero per board, packed to one byte each and put back in board order
+	__m256i zero = _mm256_setzero_si256();
+	__m256i packed = _mm256_packs_epi16(_mm256_cmpeq_epi16(low, zero), _mm256_cmpeq_epi16(high, zero));
+	return (DWORD) _mm256_movemask_epi8(_mm256_permute4x64_epi64(packed, 0xD8));
+#elif defined(RASTER_SSE2)
+	__m128i hits[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+
+	for (int row = 0; row < 4; row++)
+	{
+		if (!masks[row])
+			continue;
+
+		__m128i mask = _mm_set1_epi16((short) masks[row]);
+		const __m128i *source = (const __m128i *) (batch->rows[y + row] + first);
+		for (int part = 0; part < 4; part++)
+			hits[part] = _mm_or_si128(hits[part], _mm_and_si128(_mm_load_si128(source + part), mask));
+	}
+
+	__m128i zero = _mm_setzero_si128();
+	DWORD low = (DWORD) _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(hits[0], zero), _mm_cmpeq_epi16(hits[1], zero)));
+	DWORD high = (DWORD) _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(hits[2], zero), _mm_cmpeq_epi16(hits[3], zero)));
+	return low | (high << 16);
+#elif defined(RASTER_NEON)
+	uint16x8_t hits[4] = { vdupq_n_u16(0), vdupq_n_u16(0), vdupq_n_u16(0), vdupq_n_u16(0) };
+
+	for (int row = 0; row < 4; row++)
+	{
+		if (!masks[row])
+			continue;
+
+		uint16x8_t mask = vdupq_n_u16(masks[row]);
+		const WORD *source = batch->rows[y + row] + first;
+		for (int part = 0; part < 4; part++)
+			hits[part] = vorrq_u16(hits[part], vandq_u16(vld1q_u16(source + part * 8), mask));
+	}
+
+	WORD lanes[BATCH_BLOCK];
+	for (int part = 0; part < 4; part++)
+		vst1q_u16(lanes + part * 8, hits[part]);
+
+	DWORD result = 0;
+	for (int b = 0; b < BATCH_BLOCK; b++)
+	{
+		if (!lanes[b])
+			result |= 1U << b;
+	}
+
+	return result;
+#else
+	return batch_block_fits_scalar(batch, masks, y, first);
+#endif
+}
+
+// results holds one DWORD per BATCH_BLOCK boards, bit b of results[i] is board i * 32 + b
+void batch_fits(const struct board_batch_t *batch, int shape, int rotation, int x, int y, DWORD *results, BOOL fScalar)
+{
+	int blocks = (batch->count + BATCH_BLOCK - 1) / BATCH_BLOCK;
+	WORD masks[4];
+
+	if (!placement_masks(shape, rotation, x, y, masks))
+	{
+		memset(results, 0, blocks * sizeof(DWORD));
+		return;
+	}
+
+	for (int block = 0; block < blocks; block++)
+		results[block] = fScalar ? batch_block_fits_scalar(batch, masks, y, block * BATCH_BLOCK) : batch_block_fits(batch, masks, y, block * BATCH_BLOCK);
+}
+
+// a set of placements, block by block so a block's rows stay in the L1 cache while every
+// placement is tested - results[p * blocks + block]
+void batch_fits_many(const struct board_batch_t *batch, int shape, const struct placement_t *placements, int count, DWORD *results)
+{
+	int blocks = (batch->count + BATCH_BLOCK - 1) / BATCH_BLOCK;
+	WORD (*masks)[4] = new WORD[count][4];
+	BOOL *fValid = new BOOL[count];
+
+	for (int p = 0; p < count; p++)
+		fValid[p] = placement_masks(shape, placements[p].rotation, placements[p].x, placements[p].y, masks[p]);
+
+	for (int block = 0; block < blocks; block++)
+	{
+		for (int p = 0; p < count; p++)
+			results[p * blocks + block] = fValid[p] ? batch_block_fits(batch, masks[p], placements[p].y, block * BATCH_BLOCK) : 0;
+	}
+
+	delete [] masks;
+	delete [] fValid;
+}
+
+// read only view of a whole file, shared by the precomputed tables and the replay reader
+struct mapped_file_t
+{
+#ifdef _WIN32
+	HANDLE hFile, hMapping;
+#else
+	int fd;
+#endif
+	const BYTE *data;
+	ULONGLONG size;
+};
+
+#ifdef _WIN32
+void unmap_file(struct mapped_file_t *mapped)
+{
+	if (mapped->data)
+		UnmapViewOfFile(mapped->data);
+	if (mapped->hMapping)
+		CloseHandle(mapped->hMapping);
+	if (mapped->hFile && mapped->hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mapped->hFile);
+
+	ZeroMemory(mapped, sizeof(struct mapped_file_t));
+}
+
+BOOL map_file(struct mapped_file_t *mapped, const char *path)
+{
+	ZeroMemory(mapped, sizeof(struct mapped_file_t));
+
+	mapped->hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mapped->hFile == INVALID_HANDLE_VALUE)
+	{
+		mapped->hFile = NULL;
+		return FALSE;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapped->hFile, &size) || size.QuadPart == 0)
+	{
+		unmap_file(mapped);
+		return FALSE;
+	}
+
+	mapped->hMapping = CreateFileMapping(mapped->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapped->hMapping)
+		mapped->data = (const BYTE *) MapViewOfFile(mapped->hMapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (!mapped->data)
+	{
+		unmap_file(mapped);
+		return FALSE;
+	}
+
+	mapped->size = (ULONGLONG) size.QuadPart;
+	return TRUE;
+}
+#else
+void unmap_file(struct mapped_file_t *mapped)
+{
+	if (mapped->data)
+		munmap((void *) mapped->data, (size_t) mapped->size);
+	if (mapped->fd > 0)
+		close(mapped->fd);
+
+	ZeroMemory(mapped, sizeof(struct mapped_file_t));
+}
+
+BOOL map_file(struct mapped_file_t *mapped, const char *path)
+{
+	ZeroMemory(mapped, sizeof(struct mapped_file_t));
+
+	mapped->fd = open(path, O_RDONLY);
+	if (mapped->fd < 0)
+	{
+		mapped->fd = 0;
+		return FALSE;
+	}
+
+	struct stat info;
+	if (fstat(mapped->fd, &info) != 0 || info.st_size == 0)
+	{
+		unmap_file(mapped);
+		return FALSE;
+	}
+
+	void *data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_SHARED, mapped->fd, 0);
+	if (data == MAP_FAILED)
+	{
+		unmap_file(mapped);
+		return FALSE;
+	}
+
+	mapped->data = (const BYTE *) data;
+	mapped->size = (ULONGLONG) info.st_size;
+	return TRUE;
+}
+#endif
+
+// last write time of a file in the platform's own units, 0 when it does not exist
+ULONGLONG file_time(const char *path)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+		return 0;
+
+	return ((ULONGLONG) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat info;
+	if (stat(path, &info) != 0)
+		return 0;
+
+	return (ULONGLONG) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+}
+
+// placement cache - the bot's answer memoized per position. the key is a 64 bit hash of the
+// whole board and the piece pair, checked against a second 32 bit hash, so a hit is the
+// answer evaluate_placements gives for that board. a key on the surface alone (the clamped
+// height difference of neighbouring columns) shares answers between boards and costs lines,
+// and in 8 games of 1000 pieces still hit only 0.1% (clamped to 4) to 1% (signs only, 45 of
+// 77 hits then pick another placement). positions do repeat exactly when the same weights
+// replay the same pieces, which is what the mapped -surface table is for
+const int SURFACE_CACHE_WAYS = 4;
+const size_t SURFACE_CACHE_BYTES = 4 << 20;
+const DWORD SURFACE_TABLE_MAGIC = 0x32465053; // "SPF2"
+
+struct surface_entry_t
+{
+	ULONGLONG key;
+	DWORD check;			// board_hash of the position, a second test on the key
+	DWORD stamp;
+	double value;
+	short rotation, x, y;	// rotation -1 when the piece has no placement
+};
+
+struct surface_table_header_t
+{
+	DWORD magic;
+	DWORD entry_size;
+	DWORD count;
+	DWORD weights;			// weights_hash of the bot that made the entries
+};
+
+struct surface_cache_t
+{
+	struct surface_entry_t *entries;
+	DWORD set_mask;
+	DWORD clock;
+
+	DWORD weights;					// weights_hash the live entries were made with
+
+	// precomputed table, sorted by key and mapped read only
+	const struct surface_entry_t *table;
+	DWORD table_count, table_weights;
+	struct mapped_file_t mapped;
+
+	ULONGLONG hits, table_hits, misses, evictions;
+};
+
+// an entry is the bot's answer for one set of weights, another bot can't use it
+DWORD weights_hash(const struct eval_weights_t *weights)
+{
+	DWORD hash = 0x811C9DC5;
+	const BYTE *bytes = (const BYTE *) weights;
+
+	for (size_t i = 0; i < sizeof(struct eval_weights_t); i++)
+		hash = (hash ^ bytes[i]) * 0x01000193;
+
+	return hash;
+}
+
+// never 0, which marks an empty entry
+ULONGLONG surface_key(const struct board_t *board, int shape, int next_shape)
+{
+	ULONGLONG key = ((ULONGLONG) shape << 3) | next_shape;
+
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+	{
+		key = (key ^ board->rows[row]) * 0x9E3779B97F4A7C15ULL;
+		key ^= key >> 29;
+	}
+
+	return key | ((ULONGLONG) 1 << 63);
+}
+
+BOOL surface_cache_create(struct surface_cache_t *cache, size_t bytes)
+{
+	ZeroMemory(cache, sizeof(struct surface_cache_t));
+
+	DWORD sets = 1;
+	while ((sets << 1) * SURFACE_CACHE_WAYS * sizeof(struct surface_entry_t) <= bytes)
+		sets <<= 1;
+
+	cache->entries = new struct surface_entry_t[sets * SURFACE_CACHE_WAYS];
+	if (!cache->entries)
+		return FALSE;
+
+	ZeroMemory(cache->entries, sizeof(struct surface_entry_t) * sets * SURFACE_CACHE_WAYS);
+	cache->set_mask = sets - 1;
+
+	return TRUE;
+}
+
+void surface_cache_unmap(struct surface_cache_t *cache)
+{
+	unmap_file(&cache->mapped);
+
+	cache->table = NULL;
+	cache->table_count = 0;
+}
+
+void surface_cache_destroy(struct surface_cache_t *cache)
+{
+	surface_cache_unmap(cache);
+
+	delete [] cache->entries;
+	cache->entries = NULL;
+}
+
+inline struct surface_entry_t *surface_set(struct surface_cache_t *cache, ULONGLONG key)
+{
+	ULONGLONG hash = key * 0x9E3779B97F4A7C15ULL;
+	return &cache->entries[((DWORD) (hash >> 32) & cache->set_mask) * SURFACE_CACHE_WAYS];
+}
+
+BOOL surface_cache_lookup(struct surface_cache_t *cache, ULONGLONG key, DWORD check, struct placement_t *result)
+{
+	struct surface_entry_t *set = surface_set(cache, key);
+
+	for (int way = 0; way < SURFACE_CACHE_WAYS; way++)
+	{
+		if (set[way].key == key && set[way].check == check)
+		{
+			set[way].stamp = ++cache->clock;
+			result->rotation = set[way].rotation, result->x = set[way].x, result->y = set[way].y;
+			result->value = set[way].value;
+			cache->hits++;
+			return TRUE;
+		}
+	}
+
+	DWORD count = (cache->table_weights == cache->weights) ? cache->table_count : 0;
+	DWORD low = 0, high = count;
+	while (low < high)
+	{
+		DWORD mid = low + (high - low) / 2;
+
+		if (cache->table[mid].key < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low < count && cache->table[low].key == key && cache->table[low].check == check)
+	{
+		result->rotation = cache->table[low].rotation, result->x = cache->table[low].x, result->y = cache->table[low].y;
+		result->value = cache->table[low].value;
+		cache->table_hits++;
+		return TRUE;
+	}
+
+	cache->misses++;
+	return FALSE;
+}
+
+// the least recently used way of the set makes room for the new entry
+void surface_cache_insert(struct surface_cache_t *cache, ULONGLONG key, DWORD check, const struct placement_t *placement)
+{
+	struct surface_entry_t *set = surface_set(cache, key);
+	struct surface_entry_t *victim = &set[0];
+
+	for (int way = 0; way < SURFACE_CACHE_WAYS; way++)
+	{
+		if (set[way].key == key || !set[way].key)
+		{
+			victim = &set[way];
+			break;
+		}
+
+		if (set[way].stamp < victim->stamp)
+			victim = &set[way];
+	}
+
+	if (victim->key && victim->key != key)
+		cache->evictions++;
+
+	victim->key = key;
+	victim->check = check;
+	victim->stamp = ++cache->clock;
+	victim->rotation = (short) placement->rotation;
+	victim->x = (short) placement->x;
+	victim->y = (short) placement->y;
+	victim->value = placement->value;
+}
+
+int compare_surface_entry(const void *a, const void *b)
+{
+	ULONGLONG ka = ((const struct surface_entry_t *) a)->key, kb = ((const struct surface_entry_t *) b)->key;
+	return (ka < kb) ? -1 : (ka > kb) ? 1 : 0;
+}
+
+// writes the live entries merged with the mapped table as a sorted table for surface_cache_map
+BOOL surface_cache_save(struct surface_cache_t *cache, const char *path)
+{
+	DWORD capacity = (cache->set_mask + 1) * SURFACE_CACHE_WAYS + cache->table_count;
+	struct surface_entry_t *sorted = new struct surface_entry_t[capacity];
+	if (!sorted)
+		return FALSE;
+
+	DWORD count = 0;
+	for (DWORD i = 0; i < (cache->set_mask + 1) * SURFACE_CACHE_WAYS; i++)
+	{
+		if (cache->entries[i].key)
+			sorted[count++] = cache->entries[i];
+	}
+
+	for (DWORD i = 0; i < cache->table_count && cache->table_weights == cache->weights; i++)
+		sorted[count++] = cache->table[i];
+
+	qsort(sorted, count, sizeof(struct surface_entry_t), compare_surface_entry);
+
+	DWORD unique = 0;
+	for (DWORD i = 0; i < count; i++)
+	{
+		if (unique == 0 || sorted[unique - 1].key != sorted[i].key)
+		{
+			sorted[unique] = sorted[i];
+			sorted[unique].stamp = 0;
+			unique++;
+		}
+	}
+
+	BOOL result = FALSE;
+	FILE *file = NULL;
+
+	if (fopen_s(&file, path, "wb") == 0 && file)
+	{
+		struct surface_table_header_t header = { SURFACE_TABLE_MAGIC, sizeof(struct surface_entry_t), unique, cache->weights };
+
+		result = fwrite(&header, sizeof(header), 1, file) == 1 && 
+				 fwrite(sorted, sizeof(struct surface_entry_t), unique, file) == unique;
+
+		fclose(file);
+	}
+
+	delete [] sorted;
+	return result;
+}
+
+BOOL surface_cache_map(struct surface_cache_t *cache, const char *path)
+{
+	surface_cache_unmap(cache);
+
+	if (!map_file(&cache->mapped, path))
+		return FALSE;
+
+	const struct surface_table_header_t *header = (const struct surface_table_header_t *) cache->mapped.data;
+	if (cache->mapped.size < sizeof(struct surface_table_header_t) || 
+		header->magic != SURFACE_TABLE_MAGIC || header->entry_size != sizeof(struct surface_entry_t) ||
+		cache->mapped.size < sizeof(struct surface_table_header_t) + (ULONGLONG) header->count * sizeof(struct surface_entry_t))
+	{
+		surface_cache_unmap(cache);
+		return FALSE;
+	}
+
+	cache->table = (const struct surface_entry_t *) (header + 1);
+	cache->table_count = header->count;
+	cache->table_weights = header->weights;
+
+	return TRUE;
+}
+
+void surface_cache_add_stats(struct surface_cache_t *total, const struct surface_cache_t *cache)
+{
+	total->hits += cache->hits, total->table_hits += cache->table_hits;
+	total->misses += cache->misses, total->evictions += cache->evictions;
+}
+
+void print_surface_stats(const struct surface_cache_t *cache)
+{
+	ULONGLONG lookups = cache->hits + cache->table_hits + cache->misses;
+
+	printf("surface cache: %llu lookups, %llu hits, %llu table hits, %llu misses, %llu evictions, %.1f%% hit rate\n", lookups, cache->hits,
+		cache->table_hits, cache->misses, cache->evictions, lookups ? 100.0 * (cache->hits + cache->table_hits) / lookups : 0.0);
+}
+
+// -surface, the precomputed table every bot cache maps
+const char *surface_table_path = NULL;
+
+BOOL surface_cache_open(struct surface_cache_t *cache)
+{
+	if (!surface_cache_create(cache, SURFACE_CACHE_BYTES))
+		return FALSE;
+
+	if (surface_table_path)
+		surface_cache_map(cache, surface_table_path);
+
+	return TRUE;
+}
+
+// bot entry point - evaluate_placements through the cache, a miss evaluates the board and
+// keeps the answer, including the answer that no placement is left
+BOOL bot_choose_placement(const struct board_t *board, int shape, int next_shape, const struct eval_weights_t *weights, 
+						  struct surface_cache_t *cache, struct placement_t *result)
+{
+	if (!cache)
+		return evaluate_placements(board, shape, next_shape, weights, result);
+
+	// a cache follows the weights it is used with, entries of other weights are dropped
+	DWORD hash = weights_hash(weights);
+	if (hash != cache->weights)
+	{
+		ZeroMemory(cache->entries, sizeof(struct surface_entry_t) * (cache->set_mask + 1) * SURFACE_CACHE_WAYS);
+		cache->weights = hash;
+	}
+
+	ULONGLONG key = surface_key(board, shape, next_shape);
+	DWORD check = board_hash(board);
+
+	if (surface_cache_lookup(cache, key, check, result))
+		return result->rotation >= 0;
+
+	BOOL found = evaluate_placements(board, shape, next_shape, weights, result);
+	if (!found)
+		result->rotation = -1;
+
+	surface_cache_insert(cache, key, check, result);
+	return found;
+}
+
+// exact solver for designed boards - answers whether a board clears completely with a known
+// queue, and how many pieces survive whatever the sequence. states are memoized in a fixed
+// transposition table sized from a memory budget, and the top of the tree is split into
+// tasks that worker threads take in turn
+const int SOLVER_MAX_QUEUE = 32;
+const int SOLVER_MAX_PLACEMENTS = 48;
+const char solver_shape_names[] = "OITLJZS";
+
+struct solver_entry_t
+{
+	std::atomic<ULONGLONG> check;	// first key ^ data, a torn write reads back as a miss
+	std::atomic<ULONGLONG> data;	// second key in the high 48 bits, depth and value below
+};
+
+struct solver_t
+{
+	struct solver_entry_t *table;
+	ULONGLONG mask;
+	int threads;
+
+	std::atomic<ULONGLONG> states, probes, hits;
+	std::atomic<bool> fFound;
+	std::atomic<int> next_task;
+	std::mutex lock;
+
+	// perfect clear
+	int queue[SOLVER_MAX_QUEUE];
+	int spawn[SOLVER_MAX_QUEUE];	// rotation each piece appears in
+	ULONGLONG salt[SOLVER_MAX_QUEUE];
+	int queue_length;
+	struct placement_t path[SOLVER_MAX_QUEUE];
+	int path_length;
+};
+
+// per thread counters, added to the solver once a thread is done
+struct solver_context_t
+{
+	ULONGLONG states, probes, hits;
+	struct placement_t path[SOLVER_MAX_QUEUE];
+	int length;
+};
+
+struct solver_stats_t
+{
+	ULONGLONG states, probes, hits;
+	double seconds;
+};
+
+BOOL solver_create(struct solver_t *solver, size_t bytes, int threads)
+{
+	ULONGLONG count = 2;
+	while (count * 2 * sizeof(struct solver_entry_t) <= bytes)
+		count *= 2;
+
+	solver->table = new struct solver_entry_t[(size_t) count];
+	if (!solver->table)
+		return FALSE;
+
+	for (ULONGLONG i = 0; i < count; i++)
+	{
+		solver->table[i].check.store(0, std::memory_order_relaxed);
+		solver->table[i].data.store(0, std::memory_order_relaxed);
+	}
+
+	solver->mask = count - 1;
+	solver->threads = (threads > 0) ? threads : 1;
+	solver->queue_length = solver->path_length = 0;
+	return TRUE;
+}
+
+void solver_destroy(struct solver_t *solver)
+{
+	delete [] solver->table;
+	solver->table = NULL;
+}
+
+// empty rows above the stack are the same on every board of that height, so hashing starts
+// at the stack. clears salt the key with the rest of the queue - entries stay valid from one
+// queue to the next. a mirrored board is a different state: pieces appear at column 4 and
+// only turn one way, so the moves the game allows are not symmetric
+inline void solver_key(const struct board_t *board, ULONGLONG salt, ULONGLONG *first, ULONGLONG *second)
+{
+	ULONGLONG a = 0x9E3779B97F4A7C15ULL ^ salt, b = 0xC2B2AE3D27D4EB4FULL + salt;
+
+	int top = 0;
+	while (top < FIELD_HEIGHT - 1 && board->rows[top] == BOARD_EMPTY_ROW)
+		top++;
+
+	for (int row = top; row < FIELD_HEIGHT - 1; row++)
+	{
+		WORD value = board->rows[row];
+		a = (a ^ value) * 0x100000001B3ULL;
+		a ^= a >> 29;
+		b = (b + value) * 0xFF51AFD7ED558CCDULL;
+		b ^= b >> 32;
+	}
+
+	*first = a, *second = b;
+}
+
+// two way buckets, returns the stored depth and value or FALSE on a miss
+BOOL solver_probe(struct solver_t *solver, struct solver_context_t *context, ULONGLONG first, ULONGLONG second, int *depth, int *value)
+{
+	context->probes++;
+
+	for (int way = 0; way < 2; way++)
+	{
+		struct solver_entry_t *entry = &solver->table[(first & solver->mask) ^ way];
+		ULONGLONG data = entry->data.load(std::memory_order_relaxed);
+		ULONGLONG check = entry->check.load(std::memory_order_relaxed);
+
+		if ((check ^ data) == first && (data >> 16) == (second >> 16))
+		{
+			*depth = (int) ((data >> 8) & 0xFF);
+			*value = (int) (data & 0xFF);
+			context->hits++;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+void solver_store(struct solver_t *solver, ULONGLONG first, ULONGLONG second, int depth, int value)
+{
+	struct solver_entry_t *slot = &solver->table[first & solver->mask];
+	struct solver_entry_t *other = &solver->table[(first & solver->mask) ^ 1];
+
+	// keep the deeper of the two results, a deeper search cost more to redo
+	if (((slot->data.load(std::memory_order_relaxed) >> 8) & 0xFF) > ((other->data.load(std::memory_order_relaxed) >> 8) & 0xFF))
+		slot = other;
+
+	ULONGLONG data = (second & ~0xFFFFULL) | ((ULONGLONG) depth << 8) | (ULONGLONG) value;
+	slot->data.store(data, std::memory_order_relaxed);
+	slot->check.store(first ^ data, std::memory_order_relaxed);
+}
+
+// adds the drop unless another rotation already covers the same cells - the I piece
+// reaches each of its placements from two rotations
+BOOL solver_add(const struct board_t *board, int shape, int rotation, int x, int y, ULONGLONG *footprints, int *count,
+				struct placement_t *placements, struct board_t *results, int *lines)
+{
+	ULONGLONG footprint = (ULONGLONG) y << 56;
+	for (int row = 0; row < 4; row++)
+	{
+		WORD mask = shape_row(shape, rotation, row);
+		footprint |= (ULONGLONG) ((x >= 0) ? (WORD) (mask << x) : (WORD) (mask >> -x)) << (row * 14);
+	}
+
+	for (int i = 0; i < *count; i++)
+	{
+		if (footprints[i] == footprint)
+			return FALSE;
+	}
+
+	int n = (*count)++;
+	footprints[n] = footprint;
+	results[n] = *board;
+	lines[n] = board_lock(&results[n], shape, rotation, x, y);
+	placements[n].rotation = rotation, placements[n].x = x, placements[n].y = y;
+	placements[n].value = 0;
+	return TRUE;
+}
+
+// every distinct drop of a shape, the same placements the bot considers
+int solver_placements(const struct board_t *board, int shape, struct placement_t *placements, struct board_t *results, int *lines)
+{
+	ULONGLONG footprints[SOLVER_MAX_PLACEMENTS];
+	int count = 0;
+
+	DWORD columns[FIELD_WIDTH];
+	board_columns(board, columns);
+
+	for (int rotation = 0; rotation < shapes[shape].count; rotation++)
+	{
+		int first, last;
+		shape_columns(shape, rotation, &first, &last);
+
+		for (int x = 1 - first; x + last < FIELD_WIDTH - 1 && count < SOLVER_MAX_PLACEMENTS; x++)
+		{
+			int y = board_drop(board, columns, shape, rotation, x);
+			if (y >= 0)
+				solver_add(board, shape, rotation, x, y, footprints, &count, placements, results, lines);
+		}
+	}
+
+	return count;
+}
+
+// rotations a piece spawned in rotation spawn can be turned to where it appears, one bit each.
+// turns only go one way, so they stop at the first that doesn't fit. 0 when the piece can't
+// appear at all, which ends the game
+inline int solver_turns(const struct board_t *board, int shape, int spawn)
+{
+	int count = shapes[shape].count, reach = 0;
+
+	for (int turn = 0, rotation = spawn; turn < count; turn++, rotation = (rotation + 1) % count)
+	{
+		if (!board_fits(board, shape, rotation, 4, 0))
+			break;
+		reach |= 1 << rotation;
+	}
+
+	return reach;
+}
+
+// every distinct placement the game's own moves reach: the piece appears at column 4 of the
+// top row, turns there, slides along the top row and is dropped. gravity while the keys are
+// pressed, and slides or turns under an overhang, are not part of the search
+int solver_reachable(const struct board_t *board, int shape, int spawn, struct placement_t *placements, struct board_t *results, int *lines)
+{
+	ULONGLONG footprints[SOLVER_MAX_PLACEMENTS];
+	int count = 0;
+	int reach = solver_turns(board, shape, spawn);
+
+	DWORD columns[FIELD_WIDTH];
+	board_columns(board, columns);
+
+	for (int rotation = 0; rotation < shapes[shape].count; rotation++)
+	{
+		if (!(reach & (1 << rotation)))
+			continue;
+
+		for (int x = 4; board_fits(board, shape, rotation, x, 0); x--)
+			solver_add(board, shape, rotation, x, column_drop(columns, shape, rotation, x, 0), footprints, &count, placements, results, lines);
+		for (int x = 5; board_fits(board, shape, rotation, x, 0); x++)
+			solver_add(board, shape, rotation, x, column_drop(columns, shape, rotation, x, 0), footprints, &count, placements, results, lines);
+	}
+
+	return count;
+}
+
+// filled cells and the number of rows holding any of them
+void solver_measure(const struct board_t *board, int *cells, int *rows)
+{
+	*cells = 0, *rows = 0;
+
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+	{
+		WORD bits = board->rows[row] & 0x07FE;
+
+		if (bits)
+			(*rows)++;
+
+		for (; bits; bits &= bits - 1)
+			(*cells)++;
+	}
+}
+
+// TRUE when the pieces from index on clear the board. every occupied row has to be cleared and
+// each clear takes ten cells, so more occupied rows than the cells can fill are cut off early
+BOOL solver_clear(struct solver_t *solver, struct solver_context_t *context, const struct board_t *board, int index)
+{
+	int cells, rows;
+	solver_measure(board, &cells, &rows);
+
+	if (!cells)
+	{
+		context->length = index;
+		return TRUE;
+	}
+
+	int remaining = solver->queue_length - index;
+	if (!remaining || rows * 10 > cells + 4 * remaining || solver->fFound.load(std::memory_order_relaxed))
+		return FALSE;
+
+	context->states++;
+
+	ULONGLONG first, second;
+	int depth, value;
+	solver_key(board, solver->salt[index], &first, &second);
+
+	if (solver_probe(solver, context, first, second, &depth, &value))
+		return FALSE;
+
+	struct placement_t placements[SOLVER_MAX_PLACEMENTS];
+	struct board_t results[SOLVER_MAX_PLACEMENTS];
+	int lines[SOLVER_MAX_PLACEMENTS];
+	int count = solver_reachable(board, solver->queue[index], solver->spawn[index], placements, results, lines);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (solver_clear(solver, context, &results[i], index + 1))
+		{
+			context->path[index] = placements[i];
+			return TRUE;
+		}
+	}
+
+	// a search cut short by another thread's solution proves nothing
+	if (!solver->fFound.load(std::memory_order_relaxed))
+		solver_store(solver, first, second, remaining, 0);
+
+	return FALSE;
+}
+
+// the spawn rotations of a shape that lead to different placements - rotations that can turn
+// to the same set reach the same placements, and on an open top that is all of them
+int solver_spawns(const struct board_t *board, int shape, int *spawns)
+{
+	int reaches[4], count = 0;
+
+	for (int spawn = 0; spawn < shapes[shape].count; spawn++)
+	{
+		int reach = solver_turns(board, shape, spawn);
+		BOOL fSeen = FALSE;
+
+		for (int i = 0; i < count && !fSeen; i++)
+			fSeen = (reaches[i] == reach);
+
+		if (!fSeen)
+			reaches[count] = reach, spawns[count++] = spawn;
+	}
+
+	return count;
+}
+
+// pieces placed before the board tops out, at most depth, whatever pieces come - the game
+// picks the shape and the rotation it appears in, and a piece that can't appear ends the game.
+// a piece whose best placement already reaches the current minimum cannot lower it, so its
+// search stops there
+int solver_survive(struct solver_t *solver, struct solver_context_t *context, const struct board_t *board, int depth)
+{
+	if (!depth)
+		return 0;
+
+	context->states++;
+
+	ULONGLONG first, second;
+	int stored_depth, stored_value;
+	solver_key(board, 0x2545F4914F6CDD1DULL, &first, &second);
+
+	// a value below its depth is exact, one equal to it is only a lower bound
+	if (solver_probe(solver, context, first, second, &stored_depth, &stored_value))
+	{
+		if (stored_value < stored_depth)
+			return (stored_value < depth) ? stored_value : depth;
+		if (stored_value >= depth)
+			return depth;
+	}
+
+	int worst = depth;
+
+	for (int shape = 0; shape < PIECE_COUNT && worst > 0; shape++)
+	{
+		int spawns[4];
+		int spawn_count = solver_spawns(board, shape, spawns);
+
+		for (int s = 0; s < spawn_count && worst > 0; s++)
+		{
+			struct placement_t placements[SOLVER_MAX_PLACEMENTS];
+			struct board_t results[SOLVER_MAX_PLACEMENTS];
+			int lines[SOLVER_MAX_PLACEMENTS];
+			int count = solver_reachable(board, shape, spawns[s], placements, results, lines);
+
+			int best = 0;
+			for (int i = 0; i < count && best < worst; i++)
+			{
+				int value = 1 + solver_survive(solver, context, &results[i], depth - 1);
+				if (value > best)
+					best = value;
+			}
+
+			if (best < worst)
+				worst = best;
+		}
+	}
+
+	solver_store(solver, first, second, depth, worst);
+	return worst;
+}
+
+struct solver_task_t
+{
+	struct board_t board;
+	int shape;
+	int depth;
+	struct placement_t path[2];
+	int value;
+};
+
+struct solver_job_t
+{
+	struct solver_t *solver;
+	struct solver_task_t *tasks;
+	int count;
+	BOOL fClear;
+};
+
+void solver_worker(struct solver_job_t *job)
+{
+	struct solver_t *solver = job->solver;
+	struct solver_context_t context;
+	ZeroMemory(&context, sizeof(context));
+
+	for (;;)
+	{
+		int index = solver->next_task.fetch_add(1);
+		if (index >= job->count)
+			break;
+
+		struct solver_task_t *task = &job->tasks[index];
+
+		if (!job->fClear)
+		{
+			task->value = 1 + solver_survive(solver, &context, &task->board, task->depth);
+			continue;
+		}
+
+		if (solver->fFound.load())
+			break;
+
+		if (solver_clear(solver, &context, &task->board, task->depth))
+		{
+			std::lock_guard<std::mutex> guard(solver->lock);
+
+			if (!solver->fFound.load())
+			{
+				for (int i = 0; i < task->depth; i++)
+					solver->path[i] = task->path[i];
+				for (int i = task->depth; i < context.length; i++)
+					solver->path[i] = context.path[i];
+
+				solver->path_length = context.length;
+				solver->fFound = true;
+			}
+		}
+	}
+
+	solver->states += context.states;
+	solver->probes += context.probes;
+	solver->hits += context.hits;
+}
+
+void solver_run(struct solver_t *solver, struct solver_task_t *tasks, int count, BOOL fClear, struct solver_stats_t *stats)
+{
+	struct solver_job_t job = { solver, tasks, count, fClear };
+	auto start = std::chrono::steady_clock::now();
+
+	solver->states = 0, solver->probes = 0, solver->hits = 0;
+	solver->next_task = 0;
+
+	std::thread *workers = new std::thread[solver->threads];
+	for (int i = 0; i < solver->threads; i++)
+		workers[i] = std::thread(solver_worker, &job);
+	for (int i = 0; i < solver->threads; i++)
+		workers[i].join();
+	delete [] workers;
+
+	if (stats)
+	{
+		stats->states = solver->states;
+		stats->probes = solver->probes;
+		stats->hits = solver->hits;
+		stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+// can the board be cleared with the queue, in order and without hold, each piece appearing in
+// its spawn rotation? on success path holds one placement per piece used and path_length how
+// many were needed
+BOOL solver_perfect_clear(struct solver_t *solver, const struct board_t *board, const int *queue, const int *spawns, int length, 
+						  struct solver_stats_t *stats)
+{
+	if (length > SOLVER_MAX_QUEUE)
+		length = SOLVER_MAX_QUEUE;
+
+	memcpy(solver->queue, queue, length * sizeof(int));
+	memcpy(solver->spawn, spawns, length * sizeof(int));
+	solver->queue_length = length;
+
+	ULONGLONG salt = 0x5851F42D4C957F2DULL;
+	for (int i = length - 1; i >= 0; i--)
+	{
+		salt = (salt ^ (ULONGLONG) (queue[i] * 4 + spawns[i] + 1)) * 0xD6E8FEB86659FD93ULL;
+		solver->salt[i] = salt ^ (salt >> 32);
+	}
+	solver->path_length = 0;
+	solver->fFound = false;
+
+	int cells, height;
+	solver_measure(board, &cells, &height);
+	if (!cells)
+		return TRUE;
+	if (!length)
+		return FALSE;
+
+	// the first two pieces give enough tasks to keep every thread busy
+	struct placement_t placements[SOLVER_MAX_PLACEMENTS];
+	struct board_t results[SOLVER_MAX_PLACEMENTS];
+	int lines[SOLVER_MAX_PLACEMENTS];
+	int count = solver_reachable(board, queue[0], spawns[0], placements, results, lines);
+
+	struct solver_task_t *tasks = new struct solver_task_t[SOLVER_MAX_PLACEMENTS * SOLVER_MAX_PLACEMENTS];
+	int task_count = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		solver_measure(&results[i], &cells, &height);
+
+		if (!cells || length == 1)
+		{
+			tasks[task_count].board = results[i];
+			tasks[task_count].depth = 1;
+			tasks[task_count].path[0] = placements[i];
+			task_count++;
+			continue;
+		}
+
+		struct placement_t next[SOLVER_MAX_PLACEMENTS];
+		struct board_t next_results[SOLVER_MAX_PLACEMENTS];
+		int next_lines[SOLVER_MAX_PLACEMENTS];
+		int next_count = solver_reachable(&results[i], queue[1], spawns[1], next, next_results, next_lines);
+
+		for (int j = 0; j < next_count; j++)
+		{
+			tasks[task_count].board = next_results[j];
+			tasks[task_count].depth = 2;
+			tasks[task_count].path[0] = placements[i];
+			tasks[task_count].path[1] = next[j];
+			task_count++;
+		}
+	}
+
+	solver_run(solver, tasks, task_count, TRUE, stats);
+	delete [] tasks;
+
+	return solver->fFound;
+}
+
+// pieces guaranteed to be placed on the board against the worst sequence, searched up to depth
+// pieces - a result equal to depth means at least that many
+int solver_survival(struct solver_t *solver, const struct board_t *board, int depth, struct solver_stats_t *stats)
+{
+	if (depth > 255)
+		depth = 255;
+	if (depth <= 0)
+		return 0;
+
+	// one task per first placement of each shape and spawn rotation, the worst piece's best
+	// placement decides. a piece that can't appear leaves its best at 0
+	struct solver_task_t *tasks = new struct solver_task_t[PIECE_COUNT * 4 * SOLVER_MAX_PLACEMENTS];
+	int task_count = 0;
+	BOOL fPiece[PIECE_COUNT * 4] = { FALSE };
+
+	for (int shape = 0; shape < PIECE_COUNT; shape++)
+	{
+		int spawns[4];
+		int spawn_count = solver_spawns(board, shape, spawns);
+
+		for (int s = 0; s < spawn_count; s++)
+		{
+			struct placement_t placements[SOLVER_MAX_PLACEMENTS];
+			struct board_t results[SOLVER_MAX_PLACEMENTS];
+			int lines[SOLVER_MAX_PLACEMENTS];
+			int count = solver_reachable(board, shape, spawns[s], placements, results, lines);
+
+			fPiece[shape * 4 + spawns[s]] = TRUE;
+
+			for (int i = 0; i < count; i++)
+			{
+				tasks[task_count].board = results[i];
+				tasks[task_count].shape = shape * 4 + spawns[s];
+				tasks[task_count].depth = depth - 1;
+				tasks[task_count].path[0] = placements[i];
+				task_count++;
+			}
+		}
+	}
+
+	solver_run(solver, tasks, task_count, FALSE, stats);
+
+	int best[PIECE_COUNT * 4] = { 0 };
+	for (int i = 0; i < task_count; i++)
+	{
+		if (tasks[i].value > best[tasks[i].shape])
+			best[tasks[i].shape] = tasks[i].value;
+	}
+
+	int worst = depth;
+	for (int piece = 0; piece < PIECE_COUNT * 4; piece++)
+	{
+		if (fPiece[piece] && best[piece] < worst)
+			worst = best[piece];
+	}
+
+	delete [] tasks;
+	return worst;
+}
+
+// Monte Carlo evaluator - every candidate placement is played forward by a greedy one ply
+// policy on random pieces, and scored by the pieces it survives and the lines it clears.
+// rollouts run on a persistent pool in rounds; after each round candidates clearly behind
+// the leader are dropped, and rounds continue until one candidate is left or the move's
+// time budget runs out, so the rollout count follows the budget and the machine
+const int ROLLOUT_CANDIDATES = 12;
+const int ROLLOUT_DEPTH = 12;
+const int ROLLOUT_ROUND = 16;		// rollouts per candidate per round
+const int ROLLOUT_MAX_THREADS = 64;
+const DWORD DOMAIN_ROLLOUT = 0x20000000;
+
+struct rollout_candidate_t
+{
+	struct placement_t placement;
+	struct board_t board;
+	int lines;
+	BOOL fAlive;
+	double sum, squares;
+	int count;
+};
+
+struct rollout_stats_t
+{
+	ULONGLONG rollouts;
+	double seconds;
+	int rounds;
+	int pruned;
+};
+
+struct rollout_pool_t
+{
+	int threads;
+	std::thread workers[ROLLOUT_MAX_THREADS];
+	std::mutex lock;
+	std::condition_variable wake, done;
+	int round;						// bumped to start a round
+	int finished;
+	bool fQuit;
+
+	// the round being played
+	struct rollout_candidate_t candidates[ROLLOUT_CANDIDATES];
+	int candidate_count;
+	int next_shape;
+	struct piece_stream_t stream;
+	DWORD first_rollout;
+	std::atomic<int> next_job;
+	std::chrono::steady_clock::time_point deadline;
+
+	// per worker sums, merged after the round
+	double sums[ROLLOUT_MAX_THREADS][ROLLOUT_CANDIDATES];
+	double squares[ROLLOUT_MAX_THREADS][ROLLOUT_CANDIDATES];
+	int counts[ROLLOUT_MAX_THREADS][ROLLOUT_CANDIDATES];
+};
+
+// rollout n of a move sees the same pieces whichever candidate it follows, so differences
+// between candidates come from the placements and not from luck of the draw
+double rollout_play(const struct rollout_pool_t *pool, const struct board_t *start, DWORD rollout)
+{
+	struct board_t board = *start;
+	int lines = 0, survived = 0;
+
+	for (int step = 0; step < ROLLOUT_DEPTH; step++)
+	{
+		int shape = pool->next_shape;
+
+		if (step)
+		{
+			struct philox_words_t words;
+			philox_words_init(&words, &pool->stream, (ULONGLONG) rollout * ROLLOUT_DEPTH + step, DOMAIN_ROLLOUT);
+			shape = (int) philox_below(&words, PIECE_COUNT);
+		}
+
+		struct placement_t placement;
+		best_single_placement(&board, shape, &default_weights, &placement);
+		if (placement.value <= PLACEMENT_LOST)
+			break;
+
+		lines += board_lock(&board, shape, placement.rotation, placement.x, placement.y);
+		survived++;
+	}
+
+	return survived + 0.5 * lines;
+}
+
+void rollout_worker(struct rollout_pool_t *pool, int id)
+{
+	int seen = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(pool->lock);
+			pool->wake.wait(guard, [pool, seen] { return pool->fQuit || pool->round != seen; });
+
+			if (pool->fQuit)
+				return;
+
+			seen = pool->round;
+		}
+
+		for (int c = 0; c < ROLLOUT_CANDIDATES; c++)
+			pool->sums[id][c] = 0, pool->squares[id][c] = 0, pool->counts[id][c] = 0;
+
+		int jobs = pool->candidate_count * ROLLOUT_ROUND;
+
+		// jobs go candidate by candidate within each rollout number, a cutoff mid round
+		// leaves every live candidate with about the same count
+		for (int job; (job = pool->next_job.fetch_add(1)) < jobs; )
+		{
+			if (std::chrono::steady_clock::now() > pool->deadline)
+				break;
+
+			const struct rollout_candidate_t *candidate = &pool->candidates[job % pool->candidate_count];
+			if (!candidate->fAlive)
+				continue;
+
+			int c = job % pool->candidate_count;
+			double value = candidate->lines * 0.5 + rollout_play(pool, &candidate->board, pool->first_rollout + job / pool->candidate_count);
+
+			pool->sums[id][c] += value;
+			pool->squares[id][c] += value * value;
+			pool->counts[id][c]++;
+		}
+
+		std::lock_guard<std::mutex> guard(pool->lock);
+		if (++pool->finished == pool->threads)
+			pool->done.notify_all();
+	}
+}
+
+BOOL rollout_pool_create(struct rollout_pool_t *pool, int threads)
+{
+	pool->threads = (threads < 1) ? 1 : (threads > ROLLOUT_MAX_THREADS) ? ROLLOUT_MAX_THREADS : threads;
+	pool->round = 0;
+	pool->fQuit = false;
+
+	for (int i = 0; i < pool->threads; i++)
+		pool->workers[i] = std::thread(rollout_worker, pool, i);
+
+	return TRUE;
+}
+
+void rollout_pool_destroy(struct rollout_pool_t *pool)
+{
+	{
+		std::lock_guard<std::mutex> guard(pool->lock);
+		pool->fQuit = true;
+		pool->wake.notify_all();
+	}
+
+	for (int i = 0; i < pool->threads; i++)
+		pool->workers[i].join();
+}
+
+void rollout_round(struct rollout_pool_t *pool)
+{
+	std::unique_lock<std::mutex> guard(pool->lock);
+
+	pool->next_job = 0;
+	pool->finished = 0;
+	pool->round++;
+	pool->wake.notify_all();
+
+	pool->done.wait(guard, [pool] { return pool->finished == pool->threads; });
+}
+
+// best placement for shape within budget_ms, seed picks the random pieces of this move
+BOOL rollout_choose(struct rollout_pool_t *pool, const struct board_t *board, int shape, int next_shape, DWORD budget_ms, 
+					ULONGLONG seed, struct placement_t *result, struct rollout_stats_t *stats)
+{
+	auto start = std::chrono::steady_clock::now();
+	pool->deadline = start + std::chrono::milliseconds(budget_ms);
+
+	// the heuristic shortlists the candidates worth rolling out
+	struct placement_t placements[SOLVER_MAX_PLACEMENTS];
+	struct board_t results[SOLVER_MAX_PLACEMENTS];
+	int lines[SOLVER_MAX_PLACEMENTS];
+	int count = solver_placements(board, shape, placements, results, lines);
+
+	if (!count)
+		return FALSE;
+
+	for (int i = 0; i < count; i++)
+		placements[i].value = evaluate_board(&results[i], lines[i], &default_weights);
+
+	pool->candidate_count = 0;
+	for (int n = 0; n < ROLLOUT_CANDIDATES && n < count; n++)
+	{
+		int best = -1;
+		for (int i = 0; i < count; i++)
+		{
+			if (placements[i].value > PLACEMENT_LOST && (best < 0 || placements[i].value > placements[best].value))
+				best = i;
+		}
+
+		struct rollout_candidate_t *candidate = &pool->candidates[pool->candidate_count++];
+		candidate->placement = placements[best];
+		candidate->board = results[best];
+		candidate->lines = lines[best];
+		candidate->fAlive = TRUE;
+		candidate->sum = 0, candidate->squares = 0, candidate->count = 0;
+
+		placements[best].value = PLACEMENT_LOST;
+	}
+
+	piece_stream_init(&pool->stream, seed, 0, PIECE_UNIFORM);
+	pool->next_shape = next_shape;
+	pool->first_rollout = 0;
+
+	int alive = pool->candidate_count, rounds = 0;
+	ULONGLONG rollouts = 0;
+
+	while (alive > 1 && std::chrono::steady_clock::now() < pool->deadline)
+	{
+		rollout_round(pool);
+		pool->first_rollout += ROLLOUT_ROUND;
+		rounds++;
+
+		for (int c = 0; c < pool->candidate_count; c++)
+		{
+			struct rollout_candidate_t *candidate = &pool->candidates[c];
+
+			for (int t = 0; t < pool->threads; t++)
+			{
+				candidate->sum += pool->sums[t][c];
+				candidate->squares += pool->squares[t][c];
+				candidate->count += pool->counts[t][c];
+				rollouts += pool->counts[t][c];
+			}
+		}
+
+		// drop candidates whose mean is more than two standard errors of the difference
+		// below the leader
+		double best_mean = -1.0e9, best_variance = 0;
+		for (int c = 0; c < pool->candidate_count; c++)
+		{
+			struct rollout_candidate_t *candidate = &pool->candidates[c];
+			if (!candidate->fAlive || candidate->count < 2)
+				continue;
+
+			double mean = candidate->sum / candidate->count;
+			if (mean > best_mean)
+			{
+				best_mean = mean;
+				best_variance = (candidate->squares / candidate->count - mean * mean) / candidate->count;
+			}
+		}
+
+		for (int c = 0; c < pool->candidate_count; c++)
+		{
+			struct rollout_candidate_t *candidate = &pool->candidates[c];
+			if (!candidate->fAlive || candidate->count < 2)
+				continue;
+
+			double mean = candidate->sum / candidate->count;
+			double variance = (candidate->squares / candidate->count - mean * mean) / candidate->count;
+
+			if (mean + 2.0 * sqrt(variance + best_variance) < best_mean)
+			{
+				candidate->fAlive = FALSE;
+				alive--;
+			}
+		}
+	}
+
+	// highest mean among the survivors, the heuristic order breaks ties and unplayed rounds
+	int best = -1;
+	double best_mean = 0;
+	for (int c = 0; c < pool->candidate_count; c++)
+	{
+		const struct rollout_candidate_t *candidate = &pool->candidates[c];
+		double mean = candidate->count ? candidate->sum / candidate->count : 0;
+
+		if (candidate->fAlive && (best < 0 || mean > best_mean))
+			best = c, best_mean = mean;
+	}
+
+	*result = pool->candidates[best].placement;
+	result->value = best_mean;
+
+	if (stats)
+	{
+		stats->rollouts += rollouts;
+		stats->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		stats->rounds += rounds;
+		stats->pruned += pool->candidate_count - alive;
+	}
+
+	return TRUE;
+}
+
+// game telemetry - the game thread appends fixed size records to its own ring without locks,
+// a background writer drains every ring, packs the records in blocks and rotates the files
+enum event_type { EVENT_SPAWN = 1, EVENT_LOCK, EVENT_CLEAR, EVENT_LEVEL_UP, EVENT_GAME_OVER };
+
+struct event_t
+{
+	DWORD tick;
+	BYTE type;
+	BYTE shape, rotation;
+	signed char x;
+	BYTE y;
+	BYTE count;
+	WORD game;
+	DWORD value;
+};
+
+const DWORD EVENT_RING_SIZE = 4096;
+const DWORD TELEMETRY_BATCH = 8192;
+const DWORD TELEMETRY_FLUSH_MS = 250;
+const DWORD TELEMETRY_FILE_LIMIT = 16 * 1024 * 1024;
+const DWORD TELEMETRY_FILE_COUNT = 8;
+const DWORD TELEMETRY_BLOCK_MAGIC = 0x314C4554; // "TEL1"
+
+struct event_ring_t
+{
+	struct event_t events[EVENT_RING_SIZE];
+	std::atomic<DWORD> head, tail;
+	std::atomic<DWORD> dropped;
+	struct event_ring_t *next;
+};
+
+struct telemetry_block_t
+{
+	DWORD magic;
+	DWORD count;
+	DWORD packed;
+	DWORD dropped;
+};
+
+struct telemetry_t
+{
+	std::atomic<struct event_ring_t *> rings;
+	std::atomic<bool> running;
+	std::thread writer;
+	std::mutex lock;
+	std::condition_variable wake;
+
+	char prefix[MAX_PATH];
+	FILE *file;
+	DWORD file_index, file_bytes;
+
+	ULONGLONG written, dropped, blocks, packed_bytes;
+};
+
+struct telemetry_t telemetry;
+// rings stay registered across sessions - a thread can be between its running check and its
+// store when telemetry stops, and it finds its ring again on the next start. telemetry_free
+// releases them at shutdown
+thread_local struct event_ring_t *event_ring = NULL;
+
+struct event_ring_t *telemetry_register(void)
+{
+	struct event_ring_t *ring = new struct event_ring_t;
+	ring->head = 0, ring->tail = 0, ring->dropped = 0;
+	ring->next = telemetry.rings.load();
+
+	while (!telemetry.rings.compare_exchange_weak(ring->next, ring))
+		;
+
+	return ring;
+}
+
+// called from the tick path - a full ring drops the event rather than stall the game
+inline void log_event(const struct event_t *event)
+{
+	if (!telemetry.running.load(std::memory_order_relaxed))
+		return;
+
+	struct event_ring_t *ring = event_ring;
+	if (!ring)
+		ring = event_ring = telemetry_register();
+
+	DWORD head = ring->head.load(std::memory_order_relaxed);
+	if (head - ring->tail.load(std::memory_order_acquire) == EVENT_RING_SIZE)
+	{
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	ring->events[head & (EVENT_RING_SIZE - 1)] = *event;
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+// tick deltas, byte planes and run lengths - consecutive records differ in very few bytes.
+// a control byte below 128 is followed by that many plus one literals, otherwise the next
+// byte repeats control minus 126 times
+DWORD pack_events(const struct event_t *events, DWORD count, BYTE *packed)
+{
+	const DWORD size = sizeof(struct event_t);
+	BYTE *planes = new BYTE[count * size];
+	DWORD out = 0;
+
+	for (DWORD i = 0; i < count; i++)
+	{
+		struct event_t event = events[i];
+		if (i > 0)
+			event.tick -= events[i - 1].tick;
+
+		const BYTE *bytes = (const BYTE *) &event;
+		for (DWORD p = 0; p < size; p++)
+			planes[p * count + i] = bytes[p];
+	}
+
+	DWORD total = count * size, pos = 0;
+	while (pos < total)
+	{
+		DWORD run = 1;
+		while (pos + run < total && run < 129 && planes[pos + run] == planes[pos])
+			run++;
+
+		if (run >= 2)
+		{
+			packed[out++] = (BYTE) (run + 126);
+			packed[out++] = planes[pos];
+			pos += run;
+			continue;
+		}
+
+		DWORD start = pos, literal = 0;
+		while (pos < total && literal < 128 && (pos + 1 >= total || planes[pos + 1] != planes[pos]))
+		{
+			pos++;
+			literal++;
+		}
+
+		if (!literal)
+			literal = 1, pos++;
+
+		packed[out++] = (BYTE) (literal - 1);
+		memcpy(&packed[out], &planes[start], literal);
+		out += literal;
+	}
+
+	delete [] planes;
+	return out;
+}
+
+// FALSE if the block is damaged
+BOOL unpack_events(const BYTE *packed, DWORD packed_size, struct event_t *events, DWORD count)
+{
+	const DWORD size = sizeof(struct event_t);
+	DWORD total = count * size, pos = 0, in = 0;
+	BYTE *planes = new BYTE[total];
+
+	while (pos < total && in < packed_size)
+	{
+		BYTE control = packed[in++];
+
+		if (control < 128)
+		{
+			DWORD literal = control + 1;
+			if (in + literal > packed_size || pos + literal > total)
+				break;
+
+			memcpy(&planes[pos], &packed[in], literal);
+			in += literal, pos += literal;
+		}
+		else
+		{
+			DWORD run = control - 126;
+			if (in >= packed_size || pos + run > total)
+				break;
+
+			memset(&planes[pos], packed[in++], run);
+			pos += run;
+		}
+	}
+
+	BOOL result = (pos == total);
+
+	for (DWORD i = 0; result && i < count; i++)
+	{
+		BYTE *bytes = (BYTE *) &events[i];
+		for (DWORD p = 0; p < size; p++)
+			bytes[p] = planes[p * count + i];
+
+		if (i > 0)
+			events[i].tick += events[i - 1].tick;
+	}
+
+	delete [] planes;
+	return result;
+}
+
+void telemetry_name(char *name, size_t size, DWORD index)
+{
+	sprintf_s(name, size, "%s-%02lu.tel", telemetry.prefix, (unsigned long) index);
+}
+
+void telemetry_write(const struct event_t *events, DWORD count, DWORD dropped, BYTE *packed)
+{
+	struct telemetry_block_t block = { TELEMETRY_BLOCK_MAGIC, count, 0, dropped };
+	block.packed = pack_events(events, count, packed);
+
+	if (telemetry.file && telemetry.file_bytes + sizeof(block) + block.packed > TELEMETRY_FILE_LIMIT)
+	{
+		fclose(telemetry.file);
+		telemetry.file = NULL;
+		telemetry.file_index = (telemetry.file_index + 1) % TELEMETRY_FILE_COUNT;
+	}
+
+	if (!telemetry.file)
+	{
+		char name[MAX_PATH + 16];
+		telemetry_name(name, sizeof(name), telemetry.file_index);
+
+		if (fopen_s(&telemetry.file, name, "wb") != 0)
+			telemetry.file = NULL;
+
+		telemetry.file_bytes = 0;
+	}
+
+	if (telemetry.file)
+	{
+		fwrite(&block, sizeof(block), 1, telemetry.file);
+		fwrite(packed, 1, block.packed, telemetry.file);
+		fflush(telemetry.file);
+
+		telemetry.file_bytes += sizeof(block) + block.packed;
+	}
+
+	telemetry.written += count;
+	telemetry.blocks++;
+	telemetry.packed_bytes += sizeof(block) + block.packed;
+}
+
+// drains every ring once, returns the number of records written
+DWORD telemetry_drain(struct event_t *batch, BYTE *packed)
+{
+	DWORD count = 0, dropped = 0, total = 0;
+
+	for (struct event_ring_t *ring = telemetry.rings.load(std::memory_order_acquire); ring; ring = ring->next)
+	{
+		dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+
+		DWORD tail = ring->tail.load(std::memory_order_relaxed);
+		DWORD head = ring->head.load(std::memory_order_acquire);
+
+		while (tail != head)
+		{
+			batch[count++] = ring->events[tail & (EVENT_RING_SIZE - 1)];
+			tail++;
+
+			if (count == TELEMETRY_BATCH)
+			{
+				ring->tail.store(tail, std::memory_order_release);
+				telemetry_write(batch, count, dropped, packed);
+				total += count;
+				count = 0, dropped = 0;
+			}
+		}
+
+		ring->tail.store(tail, std::memory_order_release);
+	}
+
+	if (count || dropped)
+		telemetry_write(batch, count, dropped, packed);
+
+	telemetry.dropped += dropped;
+	return total + count;
+}
+
+void telemetry_writer(void)
+{
+	struct event_t *batch = new struct event_t[TELEMETRY_BATCH];
+	BYTE *packed = new BYTE[TELEMETRY_BATCH * sizeof(struct event_t) * 2];
+
+	while (telemetry.running.load())
+	{
+		{
+			std::unique_lock<std::mutex> guard(telemetry.lock);
+			if (telemetry.running.load())
+				telemetry.wake.wait_for(guard, std::chrono::milliseconds(TELEMETRY_FLUSH_MS));
+		}
+
+		telemetry_drain(batch, packed);
+	}
+
+	// producers stop on the running flag, one more pass picks up what they left behind
+	telemetry_drain(batch, packed);
+
+	if (telemetry.file)
+		fclose(telemetry.file);
+	telemetry.file = NULL;
+
+	delete [] packed;
+	delete [] batch;
+}
+
+// a new session carries on after the file the last one wrote, so only the oldest is replaced
+void telemetry_start(const char *prefix)
+{
+	strncpy_s(telemetry.prefix, MAX_PATH, prefix, _TRUNCATE);
+	telemetry.file = NULL;
+	telemetry.file_index = 0, telemetry.file_bytes = 0;
+	telemetry.written = 0, telemetry.dropped = 0, telemetry.blocks = 0, telemetry.packed_bytes = 0;
+
+	ULONGLONG newest = 0;
+	for (DWORD i = 0; i < TELEMETRY_FILE_COUNT; i++)
+	{
+		char name[MAX_PATH + 16];
+		telemetry_name(name, sizeof(name), i);
+
+		ULONGLONG time = file_time(name);
+		if (time > newest)
+		{
+			newest = time;
+			telemetry.file_index = (i + 1) % TELEMETRY_FILE_COUNT;
+		}
+	}
+
+	// records a thread left in its ring after the last session are not part of this one
+	for (struct event_ring_t *ring = telemetry.rings.load(); ring; ring = ring->next)
+		ring->tail.store(ring->head.load());
+
+	telemetry.running = true;
+	telemetry.writer = std::thread(telemetry_writer);
+}
+
+void telemetry_stop(void)
+{
+	if (!telemetry.writer.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(telemetry.lock);
+		telemetry.running = false;
+	}
+
+	telemetry.wake.notify_one();
+	telemetry.writer.join();
+}
+
+// at shutdown, after telemetry_stop and once every other thread that logged has been joined,
+// so the caller's is the only ring pointer still alive
+void telemetry_free(void)
+{
+	struct event_ring_t *ring = telemetry.rings.exchange(NULL);
+
+	while (ring)
+	{
+		struct event_ring_t *next = ring->next;
+		delete ring;
+		ring = next;
+	}
+
+	event_ring = NULL;
+}
+
+void log_game_event(const struct game_t *game, enum event_type type, const struct piece_t *piece, int count, DWORD value)
+{
+	if (!game->fTelemetry)
+		return;
+
+	struct event_t event;
+
+	event.tick = game->tick;
+	event.type = (BYTE) type;
+	event.shape = piece ? (BYTE) piece->shape : 0;
+	event.rotation = piece ? (BYTE) piece->rotation : 0;
+	event.x = piece ? (signed char) piece->x : 0;
+	event.y = piece ? (BYTE) piece->y : 0;
+	event.count = (BYTE) count;
+	event.game = game->number;
+	event.value = value;
+
+	log_event(&event);
+}
+
+// every change to a game goes through an action so replays can rebuild it
+enum action_type { ACTION_NONE = 0, ACTION_START, ACTION_ROTATE, ACTION_LEFT, ACTION_RIGHT, ACTION_DROP, ACTION_GRAVITY };
+
+// result flags of game_apply
+const int GAME_LOCKED = 0x01, GAME_LEVEL_UP = 0x02, GAME_OVER = 0x04;
+
+void game_start(struct game_t *game)
+{
+	game->fStart = TRUE;
+
+	clear_field(game, BLACK);
+	ZeroMemory(&game->features, sizeof(struct board_features_t));
+
+	game->level = 0, game->rows_per_level = 0, game->full_rows = 0, game->total_rows = 0, game->score = 0;
+	game->garbage_pending = 0, game->garbage_sent = 0;
+	game->number++;
+
+	game_speed(game);
+	game->fall = 0;
+	game->gravity_tick = game->tick;
+	game->lock_resets = 0;
+	game->fGrounded = FALSE;
+
+	log_game_event(game, EVENT_SPAWN, &game->active_piece, 0, 0);
+}
+
+// debug builds check the incremental features against a full scan of the field
+BOOL features_verify(const struct game_t *game)
+{
+	struct board_features_t scan;
+	ZeroMemory(&scan, sizeof(scan));
+
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+	{
+		for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		{
+			if (game->field[row][col] == BLACK)
+				continue;
+
+			scan.columns[col] |= 1U << (FIELD_HEIGHT - 2 - row);
+			scan.fill[row]++;
+			scan.cells++;
+		}
+	}
+
+	for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		features_column(&scan, col);
+
+	return !memcmp(&scan, &game->features, sizeof(scan));
+}
+
+// garbage rows sent for clearing 0 to 4 rows at once
+const int garbage_attack[5] = { 0, 0, 1, 2, 4 };
+
+// moves the piece by all the rows due since the last step in one go, then locks it once it
+// has rested for the lock delay
+int game_gravity(struct game_t *game)
+{
+	struct piece_t *piece = &game->active_piece;
+	DWORD start = game->gravity_tick;
+	ULONGLONG fall = game->fall + (ULONGLONG) (game->tick - start) * game->gravity;
+	int distance = column_drop(game->features.columns, piece->shape, piece->rotation, piece->x, piece->y);
+
+	game->gravity_tick = game->tick;
+
+	if ((fall >> GRAVITY_SHIFT) < (ULONGLONG) distance)
+	{
+		piece->y += (int) (fall >> GRAVITY_SHIFT);
+		game->fall = (DWORD) fall & (GRAVITY_ONE - 1);
+		game->fGrounded = FALSE;
+		return 0;
+	}
+
+	// the delay runs from the moment the piece reached the stack, not from this step
+	if (!game->fGrounded)
+	{
+		game->fGrounded = TRUE;
+		game->lock_tick = start + (DWORD) ((((ULONGLONG) distance << GRAVITY_SHIFT) - game->fall + game->gravity - 1) / game->gravity);
+	}
+
+	piece->y += distance;
+	game->fall = 0;
+
+	if (game->tick - game->lock_tick < LOCK_DELAY_MS)
+		return 0;
+
+	int result = GAME_LOCKED;
+
+	log_game_event(game, EVENT_LOCK, &game->active_piece, 0, game->score);
+
+	draw_piece(game, &game->active_piece);
+	features_lock(&game->features, &game->active_piece);
+	game->full_rows = remove_full_rows(game);
+	assert(features_verify(game));
+
+	switch (game->full_rows)
+	{
+	case 0: break;
+	case 1: game->score += 500; break;
+	case 2: game->score += 1000; break;
+	case 3: game->score += 1500; break;
+	case 4: game->score += 2000; break;
+	default: break;
+	}
+	
+	game->score += ((game->full_rows * game->level) + game->rows_per_level);
+	game->total_rows += game->full_rows;
+
+	if (game->full_rows)
+		log_game_event(game, EVENT_CLEAR, NULL, game->full_rows, game->score);
+
+	game->rows_per_level += game->full_rows;					
+	if (game->rows_per_level > 9)
+	{
+		game->rows_per_level = 0;
+		if (++game->level > 19)
+		{
+			game->level = 0;
+			for (int i = 0; i < 20; i++)
+				game->speed[i] = (game->speed[i] > 10) ? game->speed[i] - 10 : 0;
+		}
+
+		game_speed(game);
+
+		result |= GAME_LEVEL_UP;
+		log_game_event(game, EVENT_LEVEL_UP, NULL, game->level + 1, game->score);
+	}
+
+	// versus - a clear cancels waiting garbage and sends the rest, a lock without one lets
+	// the waiting garbage rise
+	BOOL fBuried = FALSE;
+
+	if (game->full_rows)
+	{
+		int attack = garbage_attack[game->full_rows];
+		int cancel = (attack < game->garbage_pending) ? attack : game->garbage_pending;
+
+		game->garbage_pending -= cancel;
+		game->garbage_sent += attack - cancel;
+	}
+	else if (game->garbage_pending)
+	{
+		fBuried = !add_garbage(game, game->garbage_pending);
+		game->garbage_pending = 0;
+	}
+
+	create_piece(game);
+
+	if (fBuried || !check_piece(game, &game->active_piece))
+	{
+		if (game->fTelemetry)
+		{
+			struct board_t board;
+			board_from_field(game, &board);
+			log_game_event(game, EVENT_GAME_OVER, &game->active_piece, game->level + 1, board_hash(&board));
+		}
+
+		game->fStart = FALSE;
+		clear_field(game, WHITE);
+
+		result |= GAME_OVER;
+	}
+	else
+	{
+		log_game_event(game, EVENT_SPAWN, &game->active_piece, 0, 0);
+		settle_piece(game, &game->active_piece);
+	}
+
+	return result;
+}
+
+// tick is the game time in milliseconds since ACTION_START
+int game_apply(struct game_t *game, enum action_type action, DWORD tick)
+{
+	game->tick = tick;
+
+	if (action == ACTION_START)
+	{
+		if (!game->fStart)
+			game_start(game);
+
+		return 0;
+	}
+
+	if (!game->fStart)
+		return 0;
+
+	switch (action)
+	{
+	case ACTION_ROTATE:
+		{
+			rotate_piece(game, &game->active_piece);
+			break;
+		}
+	case ACTION_LEFT:
+		{
+			left_piece(game, &game->active_piece);
+			break;
+		}
+	case ACTION_RIGHT:
+		{
+			right_piece(game, &game->active_piece);
+			break;
+		}
+	case ACTION_DROP:
+		{
+			game->score += drop_piece(game, &game->active_piece);
+			break;
+		}
+	case ACTION_GRAVITY:
+		{
+			return game_gravity(game);
+		}
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+// steers the active piece to a placement with ordinary actions, one tick apart, then lets
+// gravity lock it - the result flags are those of the locking step. locked, if given,
+// receives the piece where it came to rest
+int game_place(struct game_t *game, const struct placement_t *placement, struct piece_t *locked)
+{
+	DWORD tick = game->tick;
+
+	for (int i = 0; i < 4 && game->active_piece.rotation != placement->rotation; i++)
+		game_apply(game, ACTION_ROTATE, ++tick);
+
+	while (game->active_piece.x != placement->x)
+	{
+		int x = game->active_piece.x;
+		game_apply(game, (x > placement->x) ? ACTION_LEFT : ACTION_RIGHT, ++tick);
+
+		if (game->active_piece.x == x)
+			break;
+	}
+
+	game_apply(game, ACTION_DROP, ++tick);
+
+	if (locked)
+		*locked = game->active_piece;
+
+	// a dropped piece locks on the next gravity step
+	int result = 0;
+	while (game->fStart && !(result & GAME_LOCKED))
+		result = game_apply(game, ACTION_GRAVITY, ++tick);
+
+	return result;
+}
+
+// the keys a player presses to take the active piece to a placement, turns first and the
+// drop last - at most 16
+int placement_inputs(const struct game_t *game, const struct placement_t *placement, BYTE plan[16])
+{
+	int count = shapes[game->active_piece.shape].count;
+	int turns = (placement->rotation - game->active_piece.rotation + count) % count;
+	int moves = placement->x - game->active_piece.x;
+	int length = 0;
+
+	while (turns-- > 0)
+		plan[length++] = ACTION_ROTATE;
+	for (; moves && length < 15; moves += (moves < 0) ? 1 : -1)
+		plan[length++] = (BYTE) ((moves < 0) ? ACTION_LEFT : ACTION_RIGHT);
+
+	plan[length++] = ACTION_DROP;
+	return length;
+}
+
+// bot plugins - a shared library behind the C interface in TetrisBot.h. the plugin sees the
+// game through a view that points into it, so nothing is copied per call, and answers with a
+// placement or inputs the engine plays at once. a call can't be interrupted, so one that runs
+// past its budget forfeits the piece, which is dropped where it is
+struct bot_plugin_t
+{
+#ifdef _WIN32
+	HMODULE library;
+#else
+	void *library;
+#endif
+	const struct tetris_bot_api *api;
+	void *bot;
+	ULONGLONG calls, overruns, failures;
+	double total_us, max_us;
+	ULONGLONG latency[32];		// calls by bit length of their microseconds
+};
+
+// the shape table in the layout of the view, built once
+uint16_t bot_shapes[PIECE_COUNT][4];
+int32_t bot_rotations[PIECE_COUNT];
+
+void bot_plugin_unload(struct bot_plugin_t *plugin)
+{
+	if (!plugin->library)
+		return;
+
+	if (plugin->api && plugin->api->destroy)
+		plugin->api->destroy(plugin->bot);
+
+#ifdef _WIN32
+	FreeLibrary(plugin->library);
+#else
+	dlclose(plugin->library);
+#endif
+	plugin->library = NULL;
+}
+
+BOOL bot_plugin_load(struct bot_plugin_t *plugin, const char *path, const char *options)
+{
+	ZeroMemory(plugin, sizeof(struct bot_plugin_t));
+
+#ifdef _WIN32
+	plugin->library = LoadLibraryA(path);
+	tetris_bot_entry_fn entry = plugin->library ? (tetris_bot_entry_fn) GetProcAddress(plugin->library, "tetris_bot_entry") : NULL;
+#else
+	plugin->library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	tetris_bot_entry_fn entry = plugin->library ? (tetris_bot_entry_fn) dlsym(plugin->library, "tetris_bot_entry") : NULL;
+#endif
+
+	plugin->api = entry ? entry() : NULL;
+	if (plugin->api && plugin->api->abi == TETRIS_BOT_ABI && plugin->api->choose)
+	{
+		plugin->bot = plugin->api->create ? plugin->api->create(options ? options : "") : NULL;
+
+		if (plugin->bot || !plugin->api->create)
+		{
+			for (int shape = 0; shape < PIECE_COUNT; shape++)
+			{
+				bot_rotations[shape] = shapes[shape].count;
+				for (int rotation = 0; rotation < 4; rotation++)
+					bot_shapes[shape][rotation] = (uint16_t) shapes[shape].shape[rotation];
+			}
+
+			return TRUE;
+		}
+	}
+
+	// wrong version or no bot, the library goes without a destroy call
+	plugin->api = NULL;
+	bot_plugin_unload(plugin);
+	return FALSE;
+}
+
+inline void bot_piece_view(struct tetris_piece_view *view, const struct piece_t *piece)
+{
+	view->shape = piece->shape, view->rotation = piece->rotation;
+	view->x = piece->x, view->y = piece->y;
+}
+
+void bot_view(const struct game_t *game, DWORD budget_us, struct tetris_board_view *view)
+{
+	view->abi = TETRIS_BOT_ABI;
+	view->width = FIELD_WIDTH, view->height = FIELD_HEIGHT;
+	view->cells = &game->field[0][0];
+	view->stride = FIELD_WIDTH + INFO_WIDTH;
+	view->columns = game->features.columns;
+	view->shapes = &bot_shapes[0][0];
+	view->rotations = bot_rotations;
+	bot_piece_view(&view->active, &game->active_piece);
+	bot_piece_view(&view->next, &game->next_piece);
+	view->score = game->score, view->level = game->level, view->lines = game->total_rows;
+	view->budget_us = budget_us;
+}
+
+// asks the plugin about the active piece and plays its answer through to the lock, the
+// result flags are those of game_place
+int bot_plugin_play(struct bot_plugin_t *plugin, struct game_t *game, DWORD budget_us)
+{
+	struct tetris_board_view view;
+	struct tetris_bot_move move;
+
+	bot_view(game, budget_us, &view);
+	ZeroMemory(&move, sizeof(move));
+
+	auto start = std::chrono::steady_clock::now();
+	BOOL fAnswer = plugin->api->choose(plugin->bot, &view, &move) != 0;
+	double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+	plugin->calls++;
+	plugin->total_us += elapsed;
+	plugin->max_us = (elapsed > plugin->max_us) ? elapsed : plugin->max_us;
+	plugin->latency[bit_length((DWORD) elapsed) & 31]++;
+
+	// where the piece is now - what an overrun or a bad answer gets
+	struct placement_t placement = { game->active_piece.rotation, game->active_piece.x, 0, 0.0 };
+
+	if (elapsed > budget_us)
+		plugin->overruns++;
+	else if (!fAnswer || move.kind == TETRIS_MOVE_NONE)
+		plugin->failures++;
+	else if (move.kind == TETRIS_MOVE_PLACEMENT)
+		placement.rotation = move.rotation, placement.x = move.x;
+	else if (move.kind == TETRIS_MOVE_INPUTS)
+	{
+		ULONGLONG piece_index = game->piece_index;
+		int result = 0;
+
+		for (int i = 0; i < move.input_count && i < TETRIS_BOT_MAX_INPUTS; i++)
+		{
+			if (move.inputs[i] >= ACTION_ROTATE && move.inputs[i] <= ACTION_DROP)
+				result = game_apply(game, (enum action_type) move.inputs[i], game->tick + 1);
+		}
+
+		// inputs can't lock a piece today, but the next one must not be played for it
+		if (!game->fStart || game->piece_index != piece_index)
+			return result;
+
+		placement.rotation = game->active_piece.rotation, placement.x = game->active_piece.x;
+	}
+	else
+		plugin->failures++;
+
+	return game_place(game, &placement, NULL);
+}
+
+// weight tuner - cross-entropy search over the evaluation weights. every candidate of a
+// generation plays the same fixed seeds under the full rules and in game time, keys pressed
+// TUNER_INPUT_MS apart while gravity runs at the level's speed, so weights that leave the
+// bot too far to travel at speed lose. games run in parallel on preallocated game states,
+// and a checkpoint after each generation lets a run with the same settings resume.
+// samples come from Philox keyed on the generation, so a resumed run draws what the
+// interrupted one would have
+const int TUNER_WEIGHTS = 4;
+const DWORD TUNER_MAGIC = 0x324E5554; // "TUN2"
+const DWORD TUNER_INPUT_MS = 50;
+const DWORD DOMAIN_TUNER = 0xC0000000;
+
+struct tuner_config_t
+{
+	int population, elite;
+	int seeds;
+	int piece_limit;
+	int threads;
+	ULONGLONG seed;
+};
+
+// everything a checkpoint holds, the settings it was made with included
+struct tuner_state_t
+{
+	DWORD magic;
+	struct tuner_config_t config;	// threads left out, they don't change the results
+	int generation;
+	double mean[TUNER_WEIGHTS], sigma[TUNER_WEIGHTS];
+	double best[TUNER_WEIGHTS];
+	double best_fitness;
+	ULONGLONG games;
+	double seconds;
+};
+
+struct tuner_t
+{
+	struct tuner_config_t config;
+	struct tuner_state_t state;
+	struct game_t *games;			// one per worker, reused for every game it plays
+	struct surface_cache_t *caches;	// one per worker, they follow the weights being played
+	double *candidates;				// population x TUNER_WEIGHTS
+	double *fitness;				// population
+	int *scores;					// population x seeds
+	std::atomic<int> next_job;
+};
+
+inline void weights_from_vector(const double *vector, struct eval_weights_t *weights)
+{
+	weights->height = vector[0], weights->lines = vector[1], weights->holes = vector[2], weights->bumpiness = vector[3];
+}
+
+inline void weights_to_vector(const struct eval_weights_t *weights, double *vector)
+{
+	vector[0] = weights->height, vector[1] = weights->lines, vector[2] = weights->holes, vector[3] = weights->bumpiness;
+}
+
+BOOL tuner_create(struct tuner_t *tuner, const struct tuner_config_t *config)
+{
+	tuner->config = *config;
+	if (tuner->config.threads < 1)
+		tuner->config.threads = 1;
+	if (tuner->config.elite < 1 || tuner->config.elite > tuner->config.population)
+		tuner->config.elite = (tuner->config.population + 4) / 5;
+
+	ZeroMemory(&tuner->state, sizeof(struct tuner_state_t));
+	tuner->state.magic = TUNER_MAGIC;
+	tuner->state.config = tuner->config;
+	tuner->state.config.threads = 0;
+	tuner->state.best_fitness = -1.0;
+	weights_to_vector(&default_weights, tuner->state.mean);
+	weights_to_vector(&default_weights, tuner->state.best);
+	for (int i = 0; i < TUNER_WEIGHTS; i++)
+		tuner->state.sigma[i] = 0.5;
+
+	tuner->games = new struct game_t[tuner->config.threads];
+	tuner->caches = new struct surface_cache_t[tuner->config.threads];
+	for (int i = 0; i < tuner->config.threads; i++)
+		surface_cache_open(&tuner->caches[i]);
+	tuner->candidates = new double[tuner->config.population * TUNER_WEIGHTS];
+	tuner->fitness = new double[tuner->config.population];
+	tuner->scores = new int[tuner->config.population * tuner->config.seeds];
+
+	return tuner->games && tuner->candidates && tuner->fitness && tuner->scores;
+}
+
+void tuner_destroy(struct tuner_t *tuner)
+{
+	for (int i = 0; i < tuner->config.threads && tuner->caches; i++)
+		surface_cache_destroy(&tuner->caches[i]);
+
+	delete [] tuner->games;
+	delete [] tuner->caches;
+	delete [] tuner->candidates;
+	delete [] tuner->fitness;
+	delete [] tuner->scores;
+	tuner->games = NULL, tuner->caches = NULL, tuner->candidates = NULL, tuner->fitness = NULL, tuner->scores = NULL;
+}
+
+// the bot plays one seeded game to game over or the piece limit, returns the score
+int tuner_play(struct game_t *game, struct surface_cache_t *cache, const struct eval_weights_t *weights, const struct tuner_config_t *config, int seed)
+{
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, config->seed, (DWORD) seed, PIECE_BAG);
+
+	game_init(game, &stream);
+	game_apply(game, ACTION_START, 0);
+
+	ULONGLONG planned = 0;
+	BYTE plan[16];
+	int pieces = 0, length = 0, position = 0;
+	DWORD time = 0;
+
+	while (game->fStart)
+	{
+		if (game->piece_index != planned)
+		{
+			struct board_t board;
+			struct placement_t placement;
+
+			board_from_field(game, &board);
+			if (pieces++ == config->piece_limit ||
+				!bot_choose_placement(&board, game->active_piece.shape, game->next_piece.shape, weights, cache, &placement))
+				break;
+
+			planned = game->piece_index;
+			length = placement_inputs(game, &placement, plan), position = 0;
+		}
+
+		// whichever comes first, the next key or gravity - a piece that locks before its
+		// keys are all pressed stays where gravity left it
+		DWORD due = game_gravity_due(game);
+
+		if (position < length && (int) (due - time) > 0)
+		{
+			game_apply(game, (enum action_type) plan[position++], time);
+			time += TUNER_INPUT_MS;
+		}
+		else
+			game_apply(game, ACTION_GRAVITY, ((int) (due - game->tick) > 0) ? due : game->tick);
+	}
+
+	return game->score;
+}
+
+void tuner_worker(struct tuner_t *tuner, int id)
+{
+	int seeds = tuner->config.seeds;
+	int jobs = tuner->config.population * seeds;
+
+	for (;;)
+	{
+		int job = tuner->next_job.fetch_add(1);
+		if (job >= jobs)
+			break;
+
+		struct eval_weights_t weights;
+		weights_from_vector(tuner->candidates + (job / seeds) * TUNER_WEIGHTS, &weights);
+		tuner->scores[job] = tuner_play(&tuner->games[id], &tuner->caches[id], &weights, &tuner->config, job % seeds);
+	}
+}
+
+// standard normal pair by Box-Muller from two Philox words
+void tuner_normal(struct philox_words_t *words, double *a, double *b)
+{
+	double u = (philox_next(words) + 1.0) / 4294967296.0;
+	double v = philox_next(words) / 4294967296.0;
+	double r = sqrt(-2.0 * log(u));
+
+	*a = r * cos(6.283185307179586 * v);
+	*b = r * sin(6.283185307179586 * v);
+}
+
+// samples, plays and refits one generation, returns the games played
+int tuner_generation(struct tuner_t *tuner)
+{
+	struct tuner_state_t *state = &tuner->state;
+	int population = tuner->config.population, seeds = tuner->config.seeds;
+
+	struct piece_stream_t key;
+	piece_stream_init(&key, tuner->config.seed, 0, PIECE_UNIFORM);
+
+	for (int i = 0; i < population; i++)
+	{
+		struct philox_words_t words;
+		philox_words_init(&words, &key, ((ULONGLONG) state->generation << 32) | (DWORD) i, DOMAIN_TUNER);
+
+		double *candidate = tuner->candidates + i * TUNER_WEIGHTS;
+		for (int w = 0; w < TUNER_WEIGHTS; w += 2)
+		{
+			double a, b;
+			tuner_normal(&words, &a, &b);
+			candidate[w] = state->mean[w] + state->sigma[w] * a;
+			candidate[w + 1] = state->mean[w + 1] + state->sigma[w + 1] * b;
+		}
+	}
+
+	// the first candidate is the current mean, so the search never forgets where it stands
+	memcpy(tuner->candidates, state->mean, sizeof(state->mean));
+
+	tuner->next_job = 0;
+	std::thread *workers = new std::thread[tuner->config.threads];
+	for (int i = 0; i < tuner->config.threads; i++)
+		workers[i] = std::thread(tuner_worker, tuner, i);
+	for (int i = 0; i < tuner->config.threads; i++)
+		workers[i].join();
+	delete [] workers;
+
+	int *order = new int[population];
+	for (int i = 0; i < population; i++)
+	{
+		double total = 0;
+		for (int s = 0; s < seeds; s++)
+			total += tuner->scores[i * seeds + s];
+
+		tuner->fitness[i] = total / seeds;
+		order[i] = i;
+	}
+
+	// elite by insertion sort, populations are small
+	for (int i = 1; i < population; i++)
+	{
+		int current = order[i], j = i;
+		for (; j > 0 && tuner->fitness[order[j - 1]] < tuner->fitness[current]; j--)
+			order[j] = order[j - 1];
+		order[j] = current;
+	}
+
+	if (tuner->fitness[order[0]] > state->best_fitness)
+	{
+		state->best_fitness = tuner->fitness[order[0]];
+		memcpy(state->best, tuner->candidates + order[0] * TUNER_WEIGHTS, sizeof(state->best));
+	}
+
+	// refit to the elite, smoothed, with a floor on sigma so the search keeps exploring
+	int elite = tuner->config.elite;
+	for (int w = 0; w < TUNER_WEIGHTS; w++)
+	{
+		double mean = 0, variance = 0;
+		for (int i = 0; i < elite; i++)
+			mean += tuner->candidates[order[i] * TUNER_WEIGHTS + w];
+		mean /= elite;
+
+		for (int i = 0; i < elite; i++)
+		{
+			double d = tuner->candidates[order[i] * TUNER_WEIGHTS + w] - mean;
+			variance += d * d;
+		}
+
+		state->mean[w] = 0.7 * mean + 0.3 * state->mean[w];
+		state->sigma[w] = 0.7 * sqrt(variance / elite) + 0.3 * state->sigma[w] + 0.01;
+	}
+
+	delete [] order;
+	state->generation++;
+	state->games += (ULONGLONG) population * seeds;
+	return population * seeds;
+}
+
+// written beside the checkpoint and renamed over it, a crash leaves the old one intact
+BOOL tuner_save(const struct tuner_t *tuner, const char *path)
+{
+	char temp[MAX_PATH];
+	sprintf_s(temp, sizeof(temp), "%s.tmp", path);
+
+	FILE *file = NULL;
+	if (fopen_s(&file, temp, "wb") != 0 || !file)
+		return FALSE;
+
+	BOOL result = fwrite(&tuner->state, sizeof(struct tuner_state_t), 1, file) == 1;
+	result = (fclose(file) == 0) && result;
+
+#ifdef _WIN32
+	return result && MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	return result && rename(temp, path) == 0;
+#endif
+}
+
+// 1 when the run resumes, 0 when there is no checkpoint yet and -1 when the file is not a
+// checkpoint of a run with these settings, which must not be overwritten
+int tuner_load(struct tuner_t *tuner, const char *path)
+{
+	FILE *file = NULL;
+	if (fopen_s(&file, path, "rb") != 0 || !file)
+		return 0;
+
+	struct tuner_state_t state;
+	const struct tuner_config_t *config = &tuner->config;
+	BOOL result = fread(&state, sizeof(state), 1, file) == 1 && state.magic == TUNER_MAGIC &&
+				  state.config.population == config->population && state.config.elite == config->elite &&
+				  state.config.seeds == config->seeds && state.config.piece_limit == config->piece_limit && state.config.seed == config->seed;
+	fclose(file);
+
+	if (!result)
+		return -1;
+
+	tuner->state = state;
+	return 1;
+}
+
+// versus - both peers hold the whole match, both games, and step it in VERSUS_TICK_MS ticks
+// from the shared seed, so only inputs cross the wire. the remote player's input for a tick
+// not heard from yet is predicted as no action; when the real one differs the match is
+// restored from the snapshot taken at that tick and the ticks since are simulated again.
+// a peer never runs more than VERSUS_WINDOW ticks ahead of the inputs it has, or of the
+// inputs the other side has acknowledged, so every rollback finds its snapshot
+const int VERSUS_TICK_MS = 16;
+const int VERSUS_WINDOW = 64;
+const int VERSUS_REDUNDANCY = 32;	// unacknowledged inputs repeated in every packet
+const int VERSUS_QUEUE = 256;		// packets held back by the injected delay
+const int VERSUS_ACTION_TICKS = 3;	// the bot acts at most this often
+const DWORD VERSUS_MAGIC = 0x31535256; // "VRS1"
+const DWORD DOMAIN_JITTER = 0x30000000;
+
+struct match_t
+{
+	struct game_t games[2];
+	DWORD tick;
+};
+
+void match_init(struct match_t *match, ULONGLONG seed)
+{
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, seed, 0, PIECE_BAG);
+
+	for (int player = 0; player < 2; player++)
+	{
+		game_init(&match->games[player], &stream);
+		game_apply(&match->games[player], ACTION_START, 0);
+	}
+
+	match->tick = 0;
+}
+
+// one tick - each player's action, then gravity when due, then the garbage each sent
+void match_step(struct match_t *match, const BYTE actions[2])
+{
+	DWORD time = match->tick * VERSUS_TICK_MS;
+
+	for (int player = 0; player < 2; player++)
+	{
+		struct game_t *game = &match->games[player];
+		if (!game->fStart)
+			continue;
+
+		if (actions[player] != ACTION_NONE)
+			game_apply(game, (enum action_type) actions[player], time);
+
+		if ((int) (time - game_gravity_due(game)) >= 0)
+			game_apply(game, ACTION_GRAVITY, time);
+	}
+
+	for (int player = 0; player < 2; player++)
+	{
+		match->games[1 - player].garbage_pending += match->games[player].garbage_sent;
+		match->games[player].garbage_sent = 0;
+	}
+
+	match->tick++;
+}
+
+// compares the two peers' matches, padding bytes left out
+DWORD match_hash(const struct match_t *match)
+{
+	DWORD hash = 0x811C9DC5;
+
+	for (int player = 0; player < 2; player++)
+	{
+		const struct game_t *game = &match->games[player];
+		int values[] = { game->score, game->total_rows, game->level, game->garbage_pending, (int) game->piece_index, game->fStart,
+						 game->active_piece.x, game->active_piece.y, game->active_piece.rotation, game->active_piece.shape };
+
+		for (int row = 0; row < FIELD_HEIGHT; row++)
+		{
+			for (int col = 0; col < FIELD_WIDTH; col++)
+				hash = (hash ^ game->field[row][col]) * 0x01000193;
+		}
+
+		for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+			hash = (hash ^ (DWORD) values[i]) * 0x01000193;
+	}
+
+	return hash;
+}
+
+struct versus_packet_t
+{
+	DWORD magic;
+	DWORD first;					// tick of inputs[0]
+	DWORD ack;						// the sender holds our inputs for every tick below this
+	DWORD sent;						// sender clock in microseconds
+	DWORD echo;						// latest of our clocks the sender has seen
+	BYTE count;
+	BYTE inputs[VERSUS_REDUNDANCY];
+};
+
+struct versus_delayed_t
+{
+	ULONGLONG due;
+	struct versus_packet_t packet;
+};
+
+struct versus_peer_t
+{
+	int player;
+	SOCKET socket;
+	struct sockaddr_in address;
+	DWORD delay_ms, jitter_ms;
+	struct piece_stream_t jitter;
+	ULONGLONG jitter_index;
+	std::chrono::steady_clock::time_point start;
+
+	struct match_t match;
+	struct match_t snapshots[VERSUS_WINDOW];	// state at the start of tick t in slot t % VERSUS_WINDOW
+	BYTE local[VERSUS_WINDOW], remote[VERSUS_WINDOW], predicted[VERSUS_WINDOW];
+	DWORD confirmed;				// remote inputs known for every tick below this
+	DWORD remote_ack;
+	DWORD echo;
+
+	struct versus_delayed_t queue[VERSUS_QUEUE];
+	int queued;
+
+	// the local bot's plan for its current piece
+	struct surface_cache_t cache;
+	ULONGLONG planned_piece;
+	BYTE plan[16];
+	int plan_length, plan_position;
+	int cooldown;
+
+	ULONGLONG rollbacks, rollback_ticks, stalls, round_trips;
+	DWORD max_depth;
+	double round_trip_total, round_trip_max, resimulate_max;
+};
+
+inline ULONGLONG versus_clock(const struct versus_peer_t *peer)
+{
+	return (ULONGLONG) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - peer->start).count();
+}
+
+// loopback UDP between two ports, non-blocking so the frame loop never waits on the network
+BOOL versus_open(struct versus_peer_t *peer, int player, int port, ULONGLONG seed, DWORD delay_ms, DWORD jitter_ms)
+{
+#ifdef _WIN32
+	WSADATA wsa;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+		return FALSE;
+#endif
+
+	peer->socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (peer->socket == INVALID_SOCKET)
+		return FALSE;
+
+	struct sockaddr_in local;
+	ZeroMemory(&local, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	local.sin_port = htons((unsigned short) (port + player));
+
+	peer->address = local;
+	peer->address.sin_port = htons((unsigned short) (port + 1 - player));
+
+#ifdef _WIN32
+	u_long fNonBlocking = 1;
+	BOOL fReady = ioctlsocket(peer->socket, FIONBIO, &fNonBlocking) == 0;
+#else
+	BOOL fReady = fcntl(peer->socket, F_SETFL, fcntl(peer->socket, F_GETFL, 0) | O_NONBLOCK) == 0;
+#endif
+
+	if (!fReady || bind(peer->socket, (struct sockaddr *) &local, sizeof(local)) != 0)
+	{
+		closesocket(peer->socket);
+		return FALSE;
+	}
+
+	peer->player = player;
+	peer->delay_ms = delay_ms, peer->jitter_ms = jitter_ms;
+	piece_stream_init(&peer->jitter, seed, (DWORD) player, PIECE_UNIFORM);
+	peer->jitter_index = 0;
+	peer->start = std::chrono::steady_clock::now();
+
+	match_init(&peer->match, seed);
+	peer->confirmed = 0, peer->remote_ack = 0, peer->echo = 0;
+	peer->queued = 0;
+	peer->planned_piece = 0, peer->plan_length = 0, peer->plan_position = 0, peer->cooldown = 0;
+	peer->rollbacks = 0, peer->rollback_ticks = 0, peer->stalls = 0, peer->round_trips = 0;
+	peer->max_depth = 0;
+	peer->round_trip_total = 0, peer->round_trip_max = 0, peer->resimulate_max = 0;
+
+	return surface_cache_open(&peer->cache);
+}
+
+void versus_close(struct versus_peer_t *peer)
+{
+	closesocket(peer->socket);
+	surface_cache_destroy(&peer->cache);
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+// packets wait out the injected delay plus jitter in the queue, jitter reorders them
+void versus_send(struct versus_peer_t *peer)
+{
+	struct versus_packet_t packet;
+	ZeroMemory(&packet, sizeof(packet));
+
+	packet.magic = VERSUS_MAGIC;
+	packet.first = peer->remote_ack;
+	packet.ack = peer->confirmed;
+	packet.sent = (DWORD) versus_clock(peer);
+	packet.echo = peer->echo;
+
+	for (DWORD tick = packet.first; tick < peer->match.tick && packet.count < VERSUS_REDUNDANCY; tick++)
+		packet.inputs[packet.count++] = peer->local[tick % VERSUS_WINDOW];
+
+	ULONGLONG now = versus_clock(peer);
+	ULONGLONG delay = peer->delay_ms;
+
+	if (peer->jitter_ms)
+	{
+		struct philox_words_t words;
+		philox_words_init(&words, &peer->jitter, peer->jitter_index++, DOMAIN_JITTER);
+		delay += philox_below(&words, peer->jitter_ms + 1);
+	}
+
+	if (peer->queued < VERSUS_QUEUE)
+	{
+		peer->queue[peer->queued].due = now + delay * 1000;
+		peer->queue[peer->queued].packet = packet;
+		peer->queued++;
+	}
+
+	for (int i = 0; i < peer->queued; )
+	{
+		if (peer->queue[i].due > now)
+		{
+			i++;
+			continue;
+		}
+
+		sendto(peer->socket, (const char *) &peer->queue[i].packet, sizeof(struct versus_packet_t), 0, (struct sockaddr *) &peer->address, sizeof(peer->address));
+		peer->queue[i] = peer->queue[--peer->queued];
+	}
+}
+
+// returns the earliest simulated tick whose remote input was mispredicted, or the current tick
+DWORD versus_receive(struct versus_peer_t *peer)
+{
+	DWORD rollback = peer->match.tick;
+	struct versus_packet_t packet;
+
+	for (;;)
+	{
+		int size = (int) recv(peer->socket, (char *) &packet, sizeof(packet), 0);
+		if (size != (int) sizeof(packet))
+			break;
+
+		if (packet.magic != VERSUS_MAGIC || packet.count > VERSUS_REDUNDANCY)
+			continue;
+
+		if (packet.ack > peer->remote_ack)
+			peer->remote_ack = packet.ack;
+
+		if (packet.sent > peer->echo)
+			peer->echo = packet.sent;
+
+		if (packet.echo)
+		{
+			double round_trip = ((DWORD) versus_clock(peer) - packet.echo) / 1000.0;
+			peer->round_trip_total += round_trip;
+			peer->round_trip_max = (round_trip > peer->round_trip_max) ? round_trip : peer->round_trip_max;
+			peer->round_trips++;
+		}
+
+		// only inputs for ticks already reached are taken, later ones come again
+		for (int i = 0; i < packet.count; i++)
+		{
+			DWORD tick = packet.first + i;
+			if (tick != peer->confirmed || tick > peer->match.tick)
+				continue;
+
+			BYTE input = packet.inputs[i];
+			peer->remote[tick % VERSUS_WINDOW] = input;
+			peer->confirmed++;
+
+			if (tick < peer->match.tick && input != peer->predicted[tick % VERSUS_WINDOW] && tick < rollback)
+				rollback = tick;
+		}
+	}
+
+	return rollback;
+}
+
+// one tick forward with the stored local input and the remote one or its prediction
+void versus_step(struct versus_peer_t *peer)
+{
+	DWORD tick = peer->match.tick;
+	int slot = tick % VERSUS_WINDOW;
+	BYTE actions[2];
+
+	peer->snapshots[slot] = peer->match;
+	peer->predicted[slot] = (tick < peer->confirmed) ? peer->remote[slot] : (BYTE) ACTION_NONE;
+
+	actions[peer->player] = peer->local[slot];
+	actions[1 - peer->player] = peer->predicted[slot];
+	match_step(&peer->match, actions);
+}
+
+void versus_rollback(struct versus_peer_t *peer, DWORD tick)
+{
+	auto start = std::chrono::steady_clock::now();
+	DWORD now = peer->match.tick;
+
+	peer->match = peer->snapshots[tick % VERSUS_WINDOW];
+	while (peer->match.tick < now)
+		versus_step(peer);
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	DWORD depth = now - tick;
+
+	peer->rollbacks++;
+	peer->rollback_ticks += depth;
+	peer->max_depth = (depth > peer->max_depth) ? depth : peer->max_depth;
+	peer->resimulate_max = (elapsed > peer->resimulate_max) ? elapsed : peer->resimulate_max;
+}
+
+// the local player - the bot plans once per piece and plays the plan out one action at a time
+BYTE versus_bot_input(struct versus_peer_t *peer)
+{
+	struct game_t *game = &peer->match.games[peer->player];
+
+	if (!game->fStart)
+		return ACTION_NONE;
+
+	if (game->piece_index != peer->planned_piece)
+	{
+		struct board_t board;
+		struct placement_t placement;
+
+		peer->planned_piece = game->piece_index;
+		peer->plan_length = 0, peer->plan_position = 0;
+
+		board_from_field(game, &board);
+		if (bot_choose_placement(&board, game->active_piece.shape, game->next_piece.shape, &default_weights, &peer->cache, &placement))
+			peer->plan_length = placement_inputs(game, &placement, peer->plan);
+	}
+
+	if (peer->cooldown > 0 || peer->plan_position == peer->plan_length)
+	{
+		peer->cooldown--;
+		return ACTION_NONE;
+	}
+
+	// the two bots act at different rates so the games drift apart
+	peer->cooldown = VERSUS_ACTION_TICKS - 1 + 2 * peer->player;
+	return peer->plan[peer->plan_position++];
+}
+
+// one frame - takes in remote inputs, repairs mispredictions, then steps toward real time
+void versus_frame(struct versus_peer_t *peer, DWORD ticks)
+{
+	DWORD rollback = versus_receive(peer);
+	if (rollback < peer->match.tick)
+		versus_rollback(peer, rollback);
+
+	DWORD target = (DWORD) (versus_clock(peer) / (VERSUS_TICK_MS * 1000));
+	if (target > ticks)
+		target = ticks;
+
+	for (int steps = 0; steps < 4 && peer->match.tick < target; steps++)
+	{
+		DWORD tick = peer->match.tick;
+
+		if (tick >= peer->confirmed + VERSUS_WINDOW - 1 || tick >= peer->remote_ack + VERSUS_WINDOW - 1)
+		{
+			peer->stalls++;
+			break;
+		}
+
+		peer->local[tick % VERSUS_WINDOW] = versus_bot_input(peer);
+		versus_step(peer);
+	}
+
+	versus_send(peer);
+}
+
+// replay archive - each game is a keyframe followed by its actions as tick deltas, with another
+// keyframe whenever REPLAY_KEYFRAME_TICKS have passed. a footer lists every game and, per game,
+// the tick and file offset of each keyframe, so a seek is one binary search, one keyframe copy
+// and at most REPLAY_KEYFRAME_TICKS worth of actions. keyframes carry their tick and the first
+// one of a game has its own marker, so an archive whose footer never got written can still be
+// indexed by walking the records. the previous REPLAY_KEEP archives are kept as path.1, path.2..
+const DWORD REPLAY_MAGIC = 0x34505254; // "TRP4"
+const DWORD REPLAY_KEYFRAME_TICKS = 5000;
+const BYTE REPLAY_KEYFRAME = 0xFF;
+const BYTE REPLAY_GAME = 0xFE;
+const int REPLAY_KEEP = 4;
+
+struct replay_header_t
+{
+	DWORD magic;
+	DWORD game_size;
+};
+
+struct replay_keyframe_t
+{
+	DWORD tick;
+	DWORD reserved;
+	ULONGLONG offset;
+};
+
+struct replay_game_t
+{
+	ULONGLONG offset, size;
+	ULONGLONG keyframes;
+	DWORD keyframe_count;
+	DWORD last_tick;
+	DWORD number;
+	int score;
+};
+
+struct replay_trailer_t
+{
+	ULONGLONG index;
+	DWORD game_count;
+	DWORD magic;
+};
+
+struct replay_archive_t
+{
+	FILE *file;
+	ULONGLONG offset;
+
+	struct replay_game_t *games;
+	DWORD game_count, game_capacity;
+
+	struct replay_keyframe_t *keyframes;
+	DWORD keyframe_count, keyframe_capacity;
+
+	DWORD first_keyframe;
+	DWORD keyframe_tick, last_tick;
+	BOOL fRecording;
+	BOOL fFailed;					// a write failed, nothing more is written
+};
+
+struct replay_archive_t replay;
+
+template <class T> BOOL grow_array(T **items, DWORD count, DWORD *capacity)
+{
+	if (count < *capacity)
+		return TRUE;
+
+	DWORD size = *capacity ? *capacity * 2 : 64;
+	T *grown = new T[size];
+	if (!grown)
+		return FALSE;
+
+	if (*items)
+		memcpy(grown, *items, sizeof(T) * count);
+
+	delete [] *items;
+	*items = grown;
+	*capacity = size;
+
+	return TRUE;
+}
+
+void replay_write(struct replay_archive_t *archive, const void *data, DWORD size)
+{
+	if (archive->fFailed)
+		return;
+
+	if (fwrite(data, 1, size, archive->file) != size)
+		archive->fFailed = TRUE;
+
+	archive->offset += size;
+}
+
+// path.1 is the last session, path.REPLAY_KEEP the oldest kept
+void replay_rotate(const char *path)
+{
+	char from[MAX_PATH + 16], to[MAX_PATH + 16];
+
+	for (int i = REPLAY_KEEP; i > 0; i--)
+	{
+		sprintf_s(to, sizeof(to), "%s.%d", path, i);
+		if (i > 1)
+			sprintf_s(from, sizeof(from), "%s.%d", path, i - 1);
+		else
+			sprintf_s(from, sizeof(from), "%s", path);
+
+		remove(to);
+		rename(from, to);
+	}
+}
+
+BOOL replay_create(struct replay_archive_t *archive, const char *path)
+{
+	ZeroMemory(archive, sizeof(struct replay_archive_t));
+	replay_rotate(path);
+
+	if (fopen_s(&archive->file, path, "wb") != 0 || !archive->file)
+	{
+		archive->file = NULL;
+		return FALSE;
+	}
+
+	struct replay_header_t header = { REPLAY_MAGIC, sizeof(struct game_t) };
+	replay_write(archive, &header, sizeof(header));
+
+	return TRUE;
+}
+
+void replay_keyframe(struct replay_archive_t *archive, const struct game_t *game, DWORD tick)
+{
+	if (!grow_array(&archive->keyframes, archive->keyframe_count, &archive->keyframe_capacity))
+		return;
+
+	struct replay_keyframe_t *keyframe = &archive->keyframes[archive->keyframe_count++];
+	keyframe->tick = tick;
+	keyframe->reserved = 0;
+	keyframe->offset = archive->offset;
+
+	replay_write(archive, tick ? &REPLAY_KEYFRAME : &REPLAY_GAME, 1);
+	replay_write(archive, &tick, sizeof(tick));
+	replay_write(archive, game, sizeof(struct game_t));
+
+	archive->keyframe_tick = archive->last_tick = tick;
+}
+
+void replay_end_game(struct replay_archive_t *archive, const struct game_t *game)
+{
+	if (!archive->fRecording)
+		return;
+
+	struct replay_game_t *entry = &archive->games[archive->game_count - 1];
+	entry->size = archive->offset - entry->offset;
+	entry->keyframe_count = archive->keyframe_count - archive->first_keyframe;
+	entry->last_tick = archive->last_tick;
+	entry->score = game->score;
+
+	archive->fRecording = FALSE;
+}
+
+// call right after ACTION_START has been applied
+void replay_begin_game(struct replay_archive_t *archive, const struct game_t *game)
+{
+	if (!archive->file)
+		return;
+
+	replay_end_game(archive, game);
+
+	if (!grow_array(&archive->games, archive->game_count, &archive->game_capacity))
+		return;
+
+	struct replay_game_t *entry = &archive->games[archive->game_count++];
+	ZeroMemory(entry, sizeof(struct replay_game_t));
+	entry->offset = archive->offset;
+	entry->number = game->number;
+
+	archive->first_keyframe = archive->keyframe_count;
+	archive->fRecording = TRUE;
+
+	replay_keyframe(archive, game, 0);
+}
+
+// call before the action is applied, a due keyframe then holds the state the action starts from
+void replay_record(struct replay_archive_t *archive, const struct game_t *game, enum action_type action, DWORD tick)
+{
+	if (!archive->fRecording)
+		return;
+
+	if (tick - archive->keyframe_tick >= REPLAY_KEYFRAME_TICKS)
+		replay_keyframe(archive, game, tick);
+
+	BYTE record[6];
+	DWORD size = 0, delta = tick - archive->last_tick;
+
+	record[size++] = (BYTE) action;
+	do {
+		record[size++] = (BYTE) ((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0));
+		delta >>= 7;
+	} while (delta);
+
+	replay_write(archive, record, size);
+	archive->last_tick = tick;
+}
+
+// FALSE when any part of the archive failed to reach the disk
+BOOL replay_close(struct replay_archive_t *archive, const struct game_t *game)
+{
+	if (!archive->file)
+		return TRUE;
+
+	replay_end_game(archive, game);
+
+	DWORD first = 0;
+	for (DWORD i = 0; i < archive->game_count; i++)
+	{
+		archive->games[i].keyframes = archive->offset;
+		replay_write(archive, &archive->keyframes[first], sizeof(struct replay_keyframe_t) * archive->games[i].keyframe_count);
+		first += archive->games[i].keyframe_count;
+	}
+
+	struct replay_trailer_t trailer = { archive->offset, archive->game_count, REPLAY_MAGIC };
+	replay_write(archive, archive->games, sizeof(struct replay_game_t) * archive->game_count);
+	replay_write(archive, &trailer, sizeof(trailer));
+
+	BOOL result = !archive->fFailed;
+	if (fclose(archive->file) != 0)
+		result = FALSE;
+
+	delete [] archive->games;
+	delete [] archive->keyframes;
+	ZeroMemory(archive, sizeof(struct replay_archive_t));
+
+	return result;
+}
+
+struct replay_reader_t
+{
+	struct mapped_file_t mapped;
+	const struct replay_game_t *games;
+	DWORD game_count;
+
+	// index rebuilt by replay_scan, keyframes then holds keyframe numbers rather than offsets
+	struct replay_game_t *scanned;
+	struct replay_keyframe_t *scanned_keyframes;
+};
+
+void replay_unmap(struct replay_reader_t *reader)
+{
+	unmap_file(&reader->mapped);
+	delete [] reader->scanned;
+	delete [] reader->scanned_keyframes;
+
+	reader->games = NULL;
+	reader->game_count = 0;
+	reader->scanned = NULL;
+	reader->scanned_keyframes = NULL;
+}
+
+inline const struct replay_keyframe_t *replay_keyframes(const struct replay_reader_t *reader, const struct replay_game_t *entry)
+{
+	if (reader->scanned_keyframes)
+		return reader->scanned_keyframes + entry->keyframes;
+
+	return (const struct replay_keyframe_t *) (reader->mapped.data + entry->keyframes);
+}
+
+BOOL replay_seek(const struct replay_reader_t *reader, DWORD index, DWORD tick, struct game_t *game);
+
+// rebuilds the index of an archive that was never closed, up to the last whole record
+BOOL replay_scan(struct replay_reader_t *reader)
+{
+	const BYTE *data = reader->mapped.data;
+	ULONGLONG size = reader->mapped.size, pos = sizeof(struct replay_header_t);
+	DWORD game_count = 0, game_capacity = 0, keyframe_count = 0, keyframe_capacity = 0;
+	struct replay_game_t *entry = NULL;
+
+	while (pos < size)
+	{
+		BYTE marker = data[pos];
+
+		if (marker == REPLAY_GAME || marker == REPLAY_KEYFRAME)
+		{
+			if (pos + 1 + sizeof(DWORD) + sizeof(struct game_t) > size || (marker == REPLAY_KEYFRAME && !entry))
+				break;
+
+			DWORD tick;
+			memcpy(&tick, data + pos + 1, sizeof(tick));
+
+			if (marker == REPLAY_GAME)
+			{
+				if (!grow_array(&reader->scanned, game_count, &game_capacity))
+					break;
+
+				entry = &reader->scanned[game_count++];
+				ZeroMemory(entry, sizeof(struct replay_game_t));
+				entry->offset = pos;
+				entry->keyframes = keyframe_count;
+				entry->number = ((const struct game_t *) (data + pos + 1 + sizeof(DWORD)))->number;
+			}
+
+			if (!grow_array(&reader->scanned_keyframes, keyframe_count, &keyframe_capacity))
+				break;
+
+			struct replay_keyframe_t *keyframe = &reader->scanned_keyframes[keyframe_count++];
+			keyframe->tick = tick;
+			keyframe->reserved = 0;
+			keyframe->offset = pos;
+			entry->keyframe_count++;
+			entry->last_tick = tick;
+
+			pos += 1 + sizeof(DWORD) + sizeof(struct game_t);
+		}
+		else if (entry && marker > ACTION_NONE && marker <= ACTION_GRAVITY)
+		{
+			ULONGLONG next = pos + 1;
+			DWORD delta = 0;
+			BOOL fWhole = FALSE;
+
+			for (int shift = 0; next < size && shift < 35; shift += 7)
+			{
+				BYTE b = data[next++];
+				delta |= (DWORD) (b & 0x7F) << shift;
+				if (!(b & 0x80))
+				{
+					fWhole = TRUE;
+					break;
+				}
+			}
+
+			if (!fWhole)
+				break;
+
+			entry->last_tick += delta;
+			pos = next;
+		}
+		else
+			break;
+
+		entry->size = pos - entry->offset;
+	}
+
+	if (!game_count)
+		return FALSE;
+
+	reader->games = reader->scanned;
+	reader->game_count = game_count;
+
+	for (DWORD i = 0; i < game_count; i++)
+	{
+		struct game_t game;
+		if (replay_seek(reader, i, reader->scanned[i].last_tick, &game))
+			reader->scanned[i].score = game.score;
+	}
+
+	return TRUE;
+}
+
+BOOL replay_map(struct replay_reader_t *reader, const char *path)
+{
+	ZeroMemory(reader, sizeof(struct replay_reader_t));
+
+	if (!map_file(&reader->mapped, path))
+		return FALSE;
+
+	const BYTE *data = reader->mapped.data;
+	ULONGLONG size = reader->mapped.size;
+
+	const struct replay_header_t *header = (const struct replay_header_t *) data;
+	if (size < sizeof(struct replay_header_t) || header->magic != REPLAY_MAGIC || header->game_size != sizeof(struct game_t))
+	{
+		replay_unmap(reader);
+		return FALSE;
+	}
+
+	// no footer - the session ended before replay_close
+	const struct replay_trailer_t *trailer = (const struct replay_trailer_t *) (data + size - sizeof(struct replay_trailer_t));
+	if (size < sizeof(struct replay_header_t) + sizeof(struct replay_trailer_t) || trailer->magic != REPLAY_MAGIC ||
+		trailer->index + (ULONGLONG) trailer->game_count * sizeof(struct replay_game_t) + sizeof(struct replay_trailer_t) != size)
+	{
+		if (replay_scan(reader))
+			return TRUE;
+
+		replay_unmap(reader);
+		return FALSE;
+	}
+
+	reader->games = (const struct replay_game_t *) (data + trailer->index);
+	reader->game_count = trailer->game_count;
+
+	for (DWORD i = 0; i < reader->game_count; i++)
+	{
+		const struct replay_game_t *entry = &reader->games[i];
+
+		if (entry->offset + entry->size > trailer->index || entry->keyframe_count == 0 ||
+			entry->keyframes + (ULONGLONG) entry->keyframe_count * sizeof(struct replay_keyframe_t) > trailer->index)
+		{
+			replay_unmap(reader);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+// state of game index at the given tick, ticks past the end give the final state
+BOOL replay_seek(const struct replay_reader_t *reader, DWORD index, DWORD tick, struct game_t *game)
+{
+	if (index >= reader->game_count)
+		return FALSE;
+
+	const BYTE *data = reader->mapped.data;
+	const struct replay_game_t *entry = &reader->games[index];
+	const struct replay_keyframe_t *keyframes = replay_keyframes(reader, entry);
+
+	DWORD low = 0, high = entry->keyframe_count;
+	while (high - low > 1)
+	{
+		DWORD mid = low + (high - low) / 2;
+
+		if (keyframes[mid].tick <= tick)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	ULONGLONG pos = keyframes[low].offset, end = entry->offset + entry->size;
+	if (pos < entry->offset || pos + 1 + sizeof(DWORD) + sizeof(struct game_t) > end ||
+		data[pos] != (low ? REPLAY_KEYFRAME : REPLAY_GAME))
+		return FALSE;
+
+	memcpy(game, data + pos + 1 + sizeof(DWORD), sizeof(struct game_t));
+	game->fTelemetry = FALSE;
+	pos += 1 + sizeof(DWORD) + sizeof(struct game_t);
+
+	DWORD now = keyframes[low].tick;
+
+	while (pos < end && data[pos] != REPLAY_KEYFRAME)
+	{
+		enum action_type action = (enum action_type) data[pos++];
+		DWORD delta = 0;
+
+		for (int shift = 0; pos < end; shift += 7)
+		{
+			BYTE b = data[pos++];
+			delta |= (DWORD) (b & 0x7F) << shift;
+			if (!(b & 0x80))
+				break;
+		}
+
+		if (now + delta > tick)
+			break;
+
+		now += delta;
+		game_apply(game, action, now);
+	}
+
+	return TRUE;
+}
+
+// training data export - one fixed size record per placed piece: the locked stack before
+// the piece, the piece and preview, where it went and what followed within a horizon of
+// SAMPLE_HORIZON pieces. producers hold a game's pending records in a ring of that size and
+// hand full blocks to a writer thread through a bounded queue, so memory stays fixed and a
+// slow disk stalls the producers instead of growing buffers. every producer may hold a block
+// it is filling, so the queue has one per producer and SAMPLE_QUEUE more for the writer.
+// records go to numbered shard files, each closed with a CRC-32 of its records, and an index
+// of fixed size entries lists every shard so a reader can map the index and find record n
+// with one division. a game stopped before it ended still writes its records, the outcome
+// counted up to where it stopped and the record marked SAMPLE_TRUNCATED
+const DWORD SAMPLE_MAGIC = 0x32504D53; // "SMP2"
+const DWORD SAMPLE_INDEX_MAGIC = 0x31584449; // "IDX1"
+const int SAMPLE_HORIZON = 1024;
+const int SAMPLE_BLOCK = 4096;
+const int SAMPLE_QUEUE = 8;
+const BYTE SAMPLE_TRUNCATED = 0x01;
+
+struct sample_t
+{
+	WORD rows[FIELD_HEIGHT - 1];	// board_t rows above the floor
+	BYTE shape, next_shape;
+	BYTE rotation;
+	signed char x;
+	BYTE y;
+	BYTE lines;						// cleared by this piece
+	BYTE flags;
+	BYTE reserved;
+	WORD survived;					// pieces placed after this one, SAMPLE_HORIZON if the game went on
+	WORD future_lines;				// cleared by those pieces
+	DWORD future_score;				// scored by those pieces
+	DWORD game;
+	DWORD move;
+	DWORD score;					// before this piece
+};
+
+struct sample_shard_header_t
+{
+	DWORD magic;
+	DWORD record_size;
+	DWORD shard;
+	DWORD count;
+	ULONGLONG first;
+	DWORD crc;
+	DWORD reserved;
+};
+
+struct sample_index_header_t
+{
+	DWORD magic;
+	DWORD record_size;
+	DWORD shard_records;
+	DWORD shard_count;
+	ULONGLONG total;
+};
+
+struct sample_index_entry_t
+{
+	ULONGLONG first;
+	DWORD count;
+	DWORD crc;
+};
+
+struct sample_block_t
+{
+	struct sample_t records[SAMPLE_BLOCK];
+	int count;
+};
+
+struct dataset_t
+{
+	char prefix[MAX_PATH];
+	DWORD shard_records;
+
+	// the queue - full blocks wait for the writer, empty ones for producers
+	struct sample_block_t *blocks;
+	struct sample_block_t **full, **empty;
+	int block_count, full_count, empty_count;
+	std::mutex lock;
+	std::condition_variable changed;
+	bool fClosing;
+	std::thread writer;
+
+	// writer side only
+	FILE *shard;
+	struct sample_shard_header_t header;
+	struct sample_index_entry_t *index;
+	DWORD index_count, index_capacity;
+	ULONGLONG total;
+	BOOL fError;
+};
+
+// per game thread - a block being filled and the records still waiting for their outcome
+struct sample_producer_t
+{
+	struct dataset_t *dataset;
+	struct sample_block_t *block;
+	struct sample_t pending[SAMPLE_HORIZON];
+	int pending_scores[SAMPLE_HORIZON];
+	int pending_rows[SAMPLE_HORIZON];
+	DWORD moves;
+	DWORD game_id;
+	struct board_t board;			// stack and score at spawn of the falling piece
+	int score;
+};
+
+DWORD crc32_table[256];
+
+void crc32_init(void)
+{
+	for (DWORD i = 0; i < 256; i++)
+	{
+		DWORD crc = i;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+
+		crc32_table[i] = crc;
+	}
+}
+
+DWORD crc32_update(DWORD crc, const void *data, size_t size)
+{
+	const BYTE *bytes = (const BYTE *) data;
+
+	crc = ~crc;
+	while (size--)
+		crc = crc32_table[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+void dataset_write_index(struct dataset_t *dataset)
+{
+	char path[MAX_PATH + 16], temp[MAX_PATH + 16];
+	sprintf_s(path, sizeof(path), "%s.idx", dataset->prefix);
+	sprintf_s(temp, sizeof(temp), "%s.idx.tmp", dataset->prefix);
+
+	FILE *file = NULL;
+	if (fopen_s(&file, temp, "wb") != 0 || !file)
+	{
+		dataset->fError = TRUE;
+		return;
+	}
+
+	struct sample_index_header_t header = { SAMPLE_INDEX_MAGIC, sizeof(struct sample_t), dataset->shard_records, (DWORD) dataset->index_count, dataset->total };
+	BOOL result = fwrite(&header, sizeof(header), 1, file) == 1;
+	result = result && fwrite(dataset->index, sizeof(struct sample_index_entry_t), dataset->index_count, file) == (size_t) dataset->index_count;
+	result = (fclose(file) == 0) && result;
+
+#ifdef _WIN32
+	result = result && MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	result = result && rename(temp, path) == 0;
+#endif
+
+	if (!result)
+		dataset->fError = TRUE;
+}
+
+// the header is written again with the final count and checksum, then the index
+void dataset_close_shard(struct dataset_t *dataset)
+{
+	if (!dataset->shard)
+		return;
+
+	fseek(dataset->shard, 0, SEEK_SET);
+	if (fwrite(&dataset->header, sizeof(dataset->header), 1, dataset->shard) != 1)
+		dataset->fError = TRUE;
+	if (fclose(dataset->shard) != 0)
+		dataset->fError = TRUE;
+	dataset->shard = NULL;
+
+	if (!grow_array(&dataset->index, dataset->index_count, &dataset->index_capacity))
+	{
+		dataset->fError = TRUE;
+		return;
+	}
+
+	struct sample_index_entry_t entry = { dataset->header.first, dataset->header.count, dataset->header.crc };
+	dataset->index[dataset->index_count++] = entry;
+	dataset_write_index(dataset);
+}
+
+void dataset_write(struct dataset_t *dataset, const struct sample_t *records, int count)
+{
+	while (count > 0 && !dataset->fError)
+	{
+		if (!dataset->shard)
+		{
+			char path[MAX_PATH + 16];
+			sprintf_s(path, sizeof(path), "%s-%05u.smp", dataset->prefix, dataset->index_count);
+
+			if (fopen_s(&dataset->shard, path, "wb") != 0 || !dataset->shard)
+			{
+				dataset->shard = NULL;
+				dataset->fError = TRUE;
+				return;
+			}
+
+			struct sample_shard_header_t header = { SAMPLE_MAGIC, sizeof(struct sample_t), (DWORD) dataset->index_count, 0, dataset->total, 0, 0 };
+			dataset->header = header;
+			fwrite(&header, sizeof(header), 1, dataset->shard);
+		}
+
+		int take = (int) (dataset->shard_records - dataset->header.count);
+		if (take > count)
+			take = count;
+
+		if (fwrite(records, sizeof(struct sample_t), take, dataset->shard) != (size_t) take)
+			dataset->fError = TRUE;
+
+		dataset->header.crc = crc32_update(dataset->header.crc, records, take * sizeof(struct sample_t));
+		dataset->header.count += take;
+		dataset->total += take;
+		records += take, count -= take;
+
+		if (dataset->header.count == dataset->shard_records)
+			dataset_close_shard(dataset);
+	}
+}
+
+void dataset_writer(struct dataset_t *dataset)
+{
+	std::unique_lock<std::mutex> guard(dataset->lock);
+
+	for (;;)
+	{
+		dataset->changed.wait(guard, [dataset] { return dataset->full_count > 0 || dataset->fClosing; });
+
+		if (!dataset->full_count)
+			break;
+
+		struct sample_block_t *block = dataset->full[0];
+		memmove(dataset->full, dataset->full + 1, --dataset->full_count * sizeof(struct sample_block_t *));
+
+		guard.unlock();
+		dataset_write(dataset, block->records, block->count);
+		guard.lock();
+
+		block->count = 0;
+		dataset->empty[dataset->empty_count++] = block;
+		dataset->changed.notify_all();
+	}
+}
+
+// producers is how many sample_producer_t will write at once
+BOOL dataset_open(struct dataset_t *dataset, const char *prefix, DWORD shard_records, int producers)
+{
+	strncpy_s(dataset->prefix, sizeof(dataset->prefix), prefix, _TRUNCATE);
+	dataset->shard_records = shard_records ? shard_records : 1 << 20;
+
+	dataset->block_count = ((producers > 0) ? producers : 1) + SAMPLE_QUEUE;
+	dataset->blocks = new struct sample_block_t[dataset->block_count];
+	dataset->full = new struct sample_block_t *[dataset->block_count];
+	dataset->empty = new struct sample_block_t *[dataset->block_count];
+	if (!dataset->blocks || !dataset->full || !dataset->empty)
+		return FALSE;
+
+	for (int i = 0; i < dataset->block_count; i++)
+	{
+		dataset->blocks[i].count = 0;
+		dataset->empty[i] = &dataset->blocks[i];
+	}
+
+	dataset->full_count = 0, dataset->empty_count = dataset->block_count;
+	dataset->fClosing = false;
+	dataset->shard = NULL;
+	dataset->index = NULL, dataset->index_count = 0, dataset->index_capacity = 0;
+	dataset->total = 0;
+	dataset->fError = FALSE;
+
+	crc32_init();
+	dataset->writer = std::thread(dataset_writer, dataset);
+	return TRUE;
+}
+
+// waits for a free block, producers block here when the writer falls behind
+struct sample_block_t *dataset_acquire(struct dataset_t *dataset)
+{
+	std::unique_lock<std::mutex> guard(dataset->lock);
+	dataset->changed.wait(guard, [dataset] { return dataset->empty_count > 0; });
+
+	return dataset->empty[--dataset->empty_count];
+}
+
+void dataset_submit(struct dataset_t *dataset, struct sample_block_t *block)
+{
+	std::lock_guard<std::mutex> guard(dataset->lock);
+
+	if (block->count)
+		dataset->full[dataset->full_count++] = block;
+	else
+		dataset->empty[dataset->empty_count++] = block;
+
+	dataset->changed.notify_all();
+}
+
+// every producer must be closed first, returns FALSE if anything failed to write
+BOOL dataset_close(struct dataset_t *dataset)
+{
+	{
+		std::lock_guard<std::mutex> guard(dataset->lock);
+		dataset->fClosing = true;
+		dataset->changed.notify_all();
+	}
+
+	dataset->writer.join();
+	dataset_close_shard(dataset);
+
+	BOOL result = !dataset->fError;
+	delete [] dataset->blocks;
+	delete [] dataset->full;
+	delete [] dataset->empty;
+	delete [] dataset->index;
+	dataset->blocks = NULL, dataset->full = NULL, dataset->empty = NULL, dataset->index = NULL;
+
+	return result;
+}
+
+void sample_producer_init(struct sample_producer_t *producer, struct dataset_t *dataset, DWORD first_game)
+{
+	producer->dataset = dataset;
+	producer->block = NULL;
+	producer->moves = 0;
+	producer->game_id = first_game;
+}
+
+inline void sample_emit(struct sample_producer_t *producer, const struct game_t *game, DWORD move)
+{
+	int slot = move % SAMPLE_HORIZON;
+	struct sample_t *sample = &producer->pending[slot];
+
+	sample->survived = (WORD) (producer->moves - 1 - move);
+	sample->future_lines = (WORD) (game->total_rows - producer->pending_rows[slot]);
+	sample->future_score = (DWORD) (game->score - producer->pending_scores[slot]);
+
+	if (!producer->block)
+		producer->block = dataset_acquire(producer->dataset);
+
+	producer->block->records[producer->block->count++] = *sample;
+
+	if (producer->block->count == SAMPLE_BLOCK)
+	{
+		dataset_submit(producer->dataset, producer->block);
+		producer->block = NULL;
+	}
+}
+
+// after ACTION_START, and after every lock through sample_lock
+void sample_spawn(struct sample_producer_t *producer, const struct game_t *game)
+{
+	board_from_field(game, &producer->board);
+	producer->score = game->score;
+}
+
+// the piece as it locked, taken before the gravity step that locked it - result is that
+// step's game_apply result
+void sample_lock(struct sample_producer_t *producer, const struct game_t *game, const struct piece_t *piece, int result)
+{
+	DWORD move = producer->moves++;
+	int slot = move % SAMPLE_HORIZON;
+	struct sample_t *sample = &producer->pending[slot];
+
+	if (move >= (DWORD) SAMPLE_HORIZON)
+		sample_emit(producer, game, move - SAMPLE_HORIZON);
+
+	ZeroMemory(sample, sizeof(struct sample_t));
+	memcpy(sample->rows, producer->board.rows, sizeof(sample->rows));
+	sample->shape = (BYTE) piece->shape;
+	sample->next_shape = (BYTE) game->active_piece.shape;
+	sample->rotation = (BYTE) piece->rotation;
+	sample->x = (signed char) piece->x;
+	sample->y = (BYTE) piece->y;
+	sample->lines = (BYTE) game->full_rows;
+	sample->game = producer->game_id;
+	sample->move = move;
+
+	// the outcome counts from after this piece, lines and score it earned itself excluded
+	producer->pending_rows[slot] = game->total_rows;
+	producer->pending_scores[slot] = game->score;
+	sample->score = (DWORD) producer->score;
+
+	if (result & GAME_OVER)
+	{
+		DWORD first = (producer->moves > (DWORD) SAMPLE_HORIZON) ? producer->moves - SAMPLE_HORIZON : 0;
+		for (DWORD i = first; i < producer->moves; i++)
+			sample_emit(producer, game, i);
+
+		producer->moves = 0;
+		producer->game_id++;
+	}
+	else
+	{
+		sample_spawn(producer, game);
+	}
+}
+
+// a game stopped before it ended - its pending records are written with the outcome up to
+// the last piece placed, marked SAMPLE_TRUNCATED
+void sample_truncate(struct sample_producer_t *producer, const struct game_t *game)
+{
+	DWORD first = (producer->moves > (DWORD) SAMPLE_HORIZON) ? producer->moves - SAMPLE_HORIZON : 0;
+	for (DWORD i = first; i < producer->moves; i++)
+	{
+		producer->pending[i % SAMPLE_HORIZON].flags |= SAMPLE_TRUNCATED;
+		sample_emit(producer, game, i);
+	}
+
+	producer->moves = 0;
+	producer->game_id++;
+}
+
+// call sample_truncate first for a game still running, or its pending records are lost
+void sample_producer_close(struct sample_producer_t *producer)
+{
+	if (producer->block)
+		dataset_submit(producer->dataset, producer->block);
+
+	producer->block = NULL;
+}
+
+// analysis tree - branching what-if exploration from a position. a node holds the piece it
+// locked and nothing of the board, which is rebuilt on demand by locking the pieces again
+// from the nearest ancestor that has one. every ANALYSIS_KEYFRAME levels a node that gets
+// children keeps a board in a hash consed store, so branches that reach the same position
+// share one copy, leaves never hold one and a rebuild replays at most ANALYSIS_KEYFRAME
+// locks. rebuilt boards sit in an LRU cache
+const DWORD ANALYSIS_NONE = 0xFFFFFFFF;
+const int ANALYSIS_KEYFRAME = 4;
+
+struct analysis_node_t
+{
+	DWORD parent, child, sibling;
+	DWORD board;				// keyframe board, ANALYSIS_NONE between keyframes and on leaves
+	BYTE shape, rotation;
+	signed char x, y;
+	BYTE depth, lines;
+	WORD total_lines;			// rows cleared from the root down to here
+	float value;				// evaluate_board of the position after the lock
+};
+
+struct analysis_slot_t
+{
+	DWORD node;
+	DWORD newer, older;			// LRU order
+	DWORD chain;				// next slot in the same bucket
+	struct board_t board;
+};
+
+struct analysis_tree_t
+{
+	struct analysis_node_t *nodes;
+	DWORD node_count, node_capacity;
+
+	// hash consed keyframe boards, open addressing over board ids
+	struct board_t *boards;
+	DWORD board_count, board_capacity;
+	DWORD *board_index;
+	DWORD board_mask;
+
+	struct analysis_slot_t *slots;
+	DWORD *buckets;
+	DWORD slot_count, slot_capacity, bucket_mask;
+	DWORD newest, oldest;
+
+	ULONGLONG keyframes, hits, misses, replayed;
+};
+
+DWORD analysis_intern(struct analysis_tree_t *tree, const struct board_t *board)
+{
+	// keep the table at most half full
+	if (2 * (tree->board_count + 1) > tree->board_mask + 1)
+	{
+		DWORD size = 2 * (tree->board_mask + 1);
+		DWORD *index = new DWORD[size];
+		memset(index, 0xFF, size * sizeof(DWORD));
+
+		for (DWORD id = 0; id < tree->board_count; id++)
+		{
+			DWORD slot = board_hash(&tree->boards[id]) & (size - 1);
+			while (index[slot] != ANALYSIS_NONE)
+				slot = (slot + 1) & (size - 1);
+			index[slot] = id;
+		}
+
+		delete [] tree->board_index;
+		tree->board_index = index;
+		tree->board_mask = size - 1;
+	}
+
+	DWORD slot = board_hash(board) & tree->board_mask;
+	for (; tree->board_index[slot] != ANALYSIS_NONE; slot = (slot + 1) & tree->board_mask)
+	{
+		if (!memcmp(&tree->boards[tree->board_index[slot]], board, sizeof(struct board_t)))
+			return tree->board_index[slot];
+	}
+
+	if (!grow_array(&tree->boards, tree->board_count, &tree->board_capacity))
+		return ANALYSIS_NONE;
+
+	tree->boards[tree->board_count] = *board;
+	tree->board_index[slot] = tree->board_count;
+	return tree->board_count++;
+}
+
+BOOL analysis_create(struct analysis_tree_t *tree, const struct board_t *root, DWORD cache_entries)
+{
+	ZeroMemory(tree, sizeof(struct analysis_tree_t));
+
+	tree->board_mask = 63;
+	tree->board_index = new DWORD[64];
+	memset(tree->board_index, 0xFF, 64 * sizeof(DWORD));
+
+	DWORD buckets = 1;
+	while (buckets < cache_entries)
+		buckets <<= 1;
+
+	tree->slot_capacity = cache_entries ? cache_entries : 1;
+	tree->slots = new struct analysis_slot_t[tree->slot_capacity];
+	tree->buckets = new DWORD[buckets];
+	memset(tree->buckets, 0xFF, buckets * sizeof(DWORD));
+	tree->bucket_mask = buckets - 1;
+	tree->newest = tree->oldest = ANALYSIS_NONE;
+
+	if (!grow_array(&tree->nodes, 0, &tree->node_capacity))
+		return FALSE;
+
+	struct analysis_node_t *node = &tree->nodes[0];
+	ZeroMemory(node, sizeof(struct analysis_node_t));
+	node->parent = node->child = node->sibling = ANALYSIS_NONE;
+	node->board = analysis_intern(tree, root);
+	node->value = (float) evaluate_board(root, 0, &default_weights);
+	tree->node_count = 1;
+	tree->keyframes = 1;
+
+	return node->board != ANALYSIS_NONE;
+}
+
+void analysis_destroy(struct analysis_tree_t *tree)
+{
+	delete [] tree->nodes;
+	delete [] tree->boards;
+	delete [] tree->board_index;
+	delete [] tree->slots;
+	delete [] tree->buckets;
+	ZeroMemory(tree, sizeof(struct analysis_tree_t));
+}
+
+// cached board of a node, moved to the front of the LRU order, NULL if not cached
+const struct board_t *analysis_cached(struct analysis_tree_t *tree, DWORD node)
+{
+	DWORD slot = tree->buckets[node & tree->bucket_mask];
+	while (slot != ANALYSIS_NONE && tree->slots[slot].node != node)
+		slot = tree->slots[slot].chain;
+
+	if (slot == ANALYSIS_NONE)
+		return NULL;
+
+	struct analysis_slot_t *entry = &tree->slots[slot];
+	if (tree->newest != slot)
+	{
+		// unlink, then relink as the newest
+		tree->slots[entry->newer].older = entry->older;
+		if (entry->older != ANALYSIS_NONE)
+			tree->slots[entry->older].newer = entry->newer;
+		else
+			tree->oldest = entry->newer;
+
+		entry->newer = ANALYSIS_NONE, entry->older = tree->newest;
+		tree->slots[tree->newest].newer = slot;
+		tree->newest = slot;
+	}
+
+	return &entry->board;
+}
+
+void analysis_cache(struct analysis_tree_t *tree, DWORD node, const struct board_t *board)
+{
+	DWORD slot;
+
+	if (tree->slot_count < tree->slot_capacity)
+		slot = tree->slot_count++;
+	else
+	{
+		// the least recently used slot leaves its bucket chain and the LRU order
+		slot = tree->oldest;
+		struct analysis_slot_t *entry = &tree->slots[slot];
+
+		DWORD *link = &tree->buckets[entry->node & tree->bucket_mask];
+		while (*link != slot)
+			link = &tree->slots[*link].chain;
+		*link = entry->chain;
+
+		tree->oldest = entry->newer;
+		if (tree->oldest != ANALYSIS_NONE)
+			tree->slots[tree->oldest].older = ANALYSIS_NONE;
+		else
+			tree->newest = ANALYSIS_NONE;
+	}
+
+	struct analysis_slot_t *entry = &tree->slots[slot];
+	entry->node = node;
+	entry->board = *board;
+	entry->chain = tree->buckets[node & tree->bucket_mask];
+	tree->buckets[node & tree->bucket_mask] = slot;
+
+	entry->newer = ANALYSIS_NONE, entry->older = tree->newest;
+	if (tree->newest != ANALYSIS_NONE)
+		tree->slots[tree->newest].newer = slot;
+	else
+		tree->oldest = slot;
+	tree->newest = slot;
+}
+
+// the board after a node's lock - from the cache, a keyframe, or the closest ancestor that
+// has one with the pieces below it locked again
+void analysis_board(struct analysis_tree_t *tree, DWORD node, struct board_t *board)
+{
+	const struct board_t *cached = analysis_cached(tree, node);
+	if (cached)
+	{
+		*board = *cached;
+		tree->hits++;
+		return;
+	}
+
+	tree->misses++;
+
+	DWORD path[ANALYSIS_KEYFRAME];
+	int length = 0;
+
+	for (DWORD id = node; ; id = tree->nodes[id].parent)
+	{
+		if (tree->nodes[id].board != ANALYSIS_NONE)
+		{
+			*board = tree->boards[tree->nodes[id].board];
+			break;
+		}
+
+		if (id != node && (cached = analysis_cached(tree, id)) != NULL)
+		{
+			*board = *cached;
+			break;
+		}
+
+		path[length++] = id;
+	}
+
+	while (length-- > 0)
+	{
+		const struct analysis_node_t *step = &tree->nodes[path[length]];
+		board_lock(board, step->shape, step->rotation, step->x, step->y);
+		tree->replayed++;
+	}
+
+	analysis_cache(tree, node, board);
+}
+
+// a child of parent for a placement whose board is already known
+DWORD analysis_link(struct analysis_tree_t *tree, DWORD parent, int shape, const struct placement_t *placement, const struct board_t *board, int lines)
+{
+	if (!grow_array(&tree->nodes, tree->node_count, &tree->node_capacity))
+		return ANALYSIS_NONE;
+
+	DWORD id = tree->node_count++;
+	struct analysis_node_t *node = &tree->nodes[id], *above = &tree->nodes[parent];
+
+	node->parent = parent;
+	node->child = ANALYSIS_NONE;
+	node->sibling = above->child;
+	above->child = id;
+
+	node->shape = (BYTE) shape, node->rotation = (BYTE) placement->rotation;
+	node->x = (signed char) placement->x, node->y = (signed char) placement->y;
+	node->depth = (BYTE) (above->depth + 1), node->lines = (BYTE) lines;
+	node->total_lines = (WORD) (above->total_lines + lines);
+	node->value = (float) evaluate_board(board, lines, &default_weights);
+	node->board = ANALYSIS_NONE;
+
+	return id;
+}
+
+// a node about to get children keeps its board on keyframe levels, board is the one just
+// rebuilt for it. FALSE when the store can't grow
+BOOL analysis_keyframe(struct analysis_tree_t *tree, DWORD id, const struct board_t *board)
+{
+	struct analysis_node_t *node = &tree->nodes[id];
+	if (node->board != ANALYSIS_NONE || node->depth % ANALYSIS_KEYFRAME)
+		return TRUE;
+
+	node->board = analysis_intern(tree, board);
+	if (node->board == ANALYSIS_NONE)
+		return FALSE;
+
+	tree->keyframes++;
+	return TRUE;
+}
+
+// one branch - the piece dropped at rotation and x, ANALYSIS_NONE when it can't spawn there
+DWORD analysis_add(struct analysis_tree_t *tree, DWORD parent, int shape, int rotation, int x)
+{
+	struct board_t board;
+	analysis_board(tree, parent, &board);
+	if (!analysis_keyframe(tree, parent, &board))
+		return ANALYSIS_NONE;
+
+	DWORD columns[FIELD_WIDTH];
+	board_columns(&board, columns);
+
+	struct placement_t placement = { rotation, x, board_drop(&board, columns, shape, rotation, x), 0.0 };
+	if (placement.y < 0)
+		return ANALYSIS_NONE;
+
+	int lines = board_lock(&board, shape, rotation, x, placement.y);
+	DWORD id = analysis_link(tree, parent, shape, &placement, &board, lines);
+
+	if (id != ANALYSIS_NONE)
+		analysis_cache(tree, id, &board);
+
+	return id;
+}
+
+// every distinct placement of shape below a node, the number of children added
+int analysis_expand(struct analysis_tree_t *tree, DWORD parent, int shape)
+{
+	struct board_t board, results[SOLVER_MAX_PLACEMENTS];
+	struct placement_t placements[SOLVER_MAX_PLACEMENTS];
+	int lines[SOLVER_MAX_PLACEMENTS];
+
+	analysis_board(tree, parent, &board);
+	if (!analysis_keyframe(tree, parent, &board))
+		return 0;
+
+	int count = solver_placements(&board, shape, placements, results, lines);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (analysis_link(tree, parent, shape, &placements[i], &results[i], lines[i]) == ANALYSIS_NONE)
+			return i;
+	}
+
+	return count;
+}
+
+// best valued leaf below a node
+DWORD analysis_best_leaf(const struct analysis_tree_t *tree, DWORD node)
+{
+	DWORD best = node;
+
+	for (DWORD child = tree->nodes[node].child; child != ANALYSIS_NONE; child = tree->nodes[child].sibling)
+	{
+		DWORD leaf = analysis_best_leaf(tree, child);
+		if (best == node || tree->nodes[leaf].value > tree->nodes[best].value)
+			best = leaf;
+	}
+
+	return best;
+}
+
+size_t analysis_bytes(const struct analysis_tree_t *tree)
+{
+	return (size_t) tree->node_capacity * sizeof(struct analysis_node_t) + (size_t) tree->board_capacity * sizeof(struct board_t) +
+		(size_t) (tree->board_mask + 1) * sizeof(DWORD) + (size_t) tree->slot_capacity * sizeof(struct analysis_slot_t) + (size_t) (tree->bucket_mask + 1) * sizeof(DWORD);
+}
+
+// immutable picture of the game handed from the simulation thread to the render thread
+struct frame_t
+{
+	BYTE field[FIELD_HEIGHT][FIELD_WIDTH + INFO_WIDTH];
+	int level, total_rows, score;
+};
+
+// lock free triple buffer - the simulation owns the back frame, the renderer the front frame
+// and the middle one is swapped between them. FRAME_FRESH marks a middle frame not yet shown
+const int FRAME_FRESH = 0x04;
+
+struct triple_buffer_t
+{
+	struct frame_t frames[3];
+	std::atomic<int> middle;
+	int back, front;
+};
+
+struct triple_buffer_t frames;
+
+// the locked stack with the ghost, the falling piece and the preview drawn over it
+void frame_fill(struct frame_t *frame, const struct game_t *game)
+{
+	memcpy(frame->field, game->field, sizeof(frame->field));
+
+	if (game->fStart)
+	{
+		struct piece_t ghost = game->active_piece;
+		ghost.y += column_drop(game->features.columns, ghost.shape, ghost.rotation, ghost.x, ghost.y);
+
+		stamp_piece(frame->field, &ghost, GHOST);
+		stamp_piece(frame->field, &game->active_piece, (BYTE) shapes[game->active_piece.shape].color);
+		stamp_piece(frame->field, &game->next_piece, (BYTE) shapes[game->next_piece.shape].color);
+	}
+
+	// the panel shows zeros until the first game starts
+	frame->level = game->number ? game->level + 1 : 0;
+	frame->total_rows = game->total_rows;
+	frame->score = game->score;
+}
+
+void frame_init(const struct game_t *game)
+{
+	for (int i = 0; i < 3; i++)
+		frame_fill(&frames.frames[i], game);
+
+	frames.back = 0, frames.front = 2;
+	frames.middle = 1;
+}
+
+// simulation side, never waits for the renderer
+void frame_publish(const struct game_t *game)
+{
+	frame_fill(&frames.frames[frames.back], game);
+	frames.back = frames.middle.exchange(frames.back | FRAME_FRESH, std::memory_order_acq_rel) & 3;
+}
+
+// render side, the latest published frame or the one shown last time
+const struct frame_t *frame_acquire(void)
+{
+	if (frames.middle.load(std::memory_order_acquire) & FRAME_FRESH)
+		frames.front = frames.middle.exchange(frames.front, std::memory_order_acq_rel) & 3;
+
+	return &frames.frames[frames.front];
+}
+
+DWORD game_start_time = 0;
+
+// -export writes the player's own placements as training data
+BOOL fExport = FALSE;
+struct dataset_t dataset;
+struct sample_producer_t player_samples;
+
+// applies an action to the live game, recording it in the replay on the way
+int play_action(enum action_type action)
+{
+	if (action == ACTION_START)
+	{
+		if (game.fStart)
+			return 0;
+
+		game_start_time = timeGetTime();
+		game_apply(&game, ACTION_START, 0);
+		replay_begin_game(&replay, &game);
+		if (fExport)
+			sample_spawn(&player_samples, &game);
+		fDirty = TRUE;
+
+		return 0;
+	}
+
+	DWORD tick = timeGetTime() - game_start_time;
+
+	replay_record(&replay, &game, action, tick);
+	struct piece_t piece = game.active_piece;
+	int result = game_apply(&game, action, tick);
+	fDirty = TRUE;
+
+	if (fExport && (result & GAME_LOCKED))
+		sample_lock(&player_samples, &game, &piece, result);
+
+	if (result & GAME_OVER)
+		replay_end_game(&replay, &game);
+
+	return result;
+}
+
+// software renderer - draws the window picture into a 32 bit 0xAARRGGBB buffer (the layout of a
+// top down DIB) at any brick size. rows start 64 byte aligned so the span fills use aligned
+// SIMD stores, and after the first frame only cells and counters that changed are redrawn
+struct framebuffer_t
+{
+	DWORD *pixels;
+	int width, height, stride;
+	BYTE *memory;
+};
+
+struct raster_t
+{
+	struct framebuffer_t frame, background;
+	int brick_width, brick_height;
+	int edge, text_scale;
+	struct frame_t shown;
+	BOOL fValid;
+};
+
+const DWORD PIXEL_BLACK = 0xFF000000, PIXEL_WHITE = 0xFFFFFFFF, PIXEL_LTGRAY = 0xFFC0C0C0;
+const DWORD PIXEL_SHADOW = 0xFF808080, PIXEL_DKSHADOW = 0xFF404040;
+const DWORD PIXEL_LABEL = 0xFFFF0000, PIXEL_HELP = 0xFF0000FF;
+
+// 5x7 glyphs, bit 4 is the leftmost column
+const char font_chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ-";
+const BYTE font_glyphs[][7] =
+{
+	{ 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+	{ 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+	{ 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+	{ 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+	{ 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },
+	{ 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 }, { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },
+	{ 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },
+	{ 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+	{ 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F }, { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+	{ 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },
+	{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },
+	{ 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 }, { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+	{ 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+	{ 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },
+	{ 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E }, { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+	{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A }, { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },
+	{ 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 }, { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F },
+	{ 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }
+};
+
+inline DWORD pixel_from_color(COLORREF color)
+{
+	return 0xFF000000 | ((DWORD) GetRValue(color) << 16) | ((DWORD) GetGValue(color) << 8) | GetBValue(color);
+}
+
+BOOL framebuffer_create(struct framebuffer_t *fb, int width, int height)
+{
+	fb->width = width, fb->height = height;
+	fb->stride = (width + 15) & ~15;
+	fb->memory = new BYTE[(size_t) fb->stride * height * sizeof(DWORD) + 64];
+	if (!fb->memory)
+		return FALSE;
+
+	fb->pixels = (DWORD *) (((size_t) fb->memory + 63) & ~(size_t) 63);
+	return TRUE;
+}
+
+void framebuffer_destroy(struct framebuffer_t *fb)
+{
+	delete [] fb->memory;
+	ZeroMemory(fb, sizeof(struct framebuffer_t));
+}
+
+inline void fill_span(DWORD *dst, int count, DWORD color)
+{
+	int i = 0;
+
+	while (i < count && ((size_t) (dst + i) & 15))
+		dst[i++] = color;
+
+#if defined(RASTER_SSE2)
+	__m128i value = _mm_set1_epi32((int) color);
+	for (; i + 16 <= count; i += 16)
+	{
+		_mm_store_si128((__m128i *) (dst + i), value);
+		_mm_store_si128((__m128i *) (dst + i + 4), value);
+		_mm_store_si128((__m128i *) (dst + i + 8), value);
+		_mm_store_si128((__m128i *) (dst + i + 12), value);
+	}
+	for (; i + 4 <= count; i += 4)
+		_mm_store_si128((__m128i *) (dst + i), value);
+#elif defined(RASTER_NEON)
+	uint32x4_t value = vdupq_n_u32(color);
+	for (; i + 4 <= count; i += 4)
+		vst1q_u32(dst + i, value);
+#endif
+
+	for (; i < count; i++)
+		dst[i] = color;
+}
+
+// src and dst share the alignment of their rows, so the same prologue aligns both
+inline void copy_span(DWORD *dst, const DWORD *src, int count)
+{
+	int i = 0;
+
+	while (i < count && ((size_t) (dst + i) & 15))
+	{
+		dst[i] = src[i];
+		i++;
+	}
+
+#if defined(RASTER_SSE2)
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i b = _mm_loadu_si128((const __m128i *) (src + i + 4));
+		__m128i c = _mm_loadu_si128((const __m128i *) (src + i + 8));
+		__m128i d = _mm_loadu_si128((const __m128i *) (src + i + 12));
+		_mm_store_si128((__m128i *) (dst + i), a);
+		_mm_store_si128((__m128i *) (dst + i + 4), b);
+		_mm_store_si128((__m128i *) (dst + i + 8), c);
+		_mm_store_si128((__m128i *) (dst + i + 12), d);
+	}
+	for (; i + 4 <= count; i += 4)
+		_mm_store_si128((__m128i *) (dst + i), _mm_loadu_si128((const __m128i *) (src + i)));
+#elif defined(RASTER_NEON)
+	for (; i + 4 <= count; i += 4)
+		vst1q_u32(dst + i, vld1q_u32(src + i));
+#endif
+
+	for (; i < count; i++)
+		dst[i] = src[i];
+}
+
+// right and bottom are exclusive like FillRect
+void fill_rect(struct framebuffer_t *fb, int left, int top, int right, int bottom, DWORD color)
+{
+	if (left < 0) left = 0;
+	if (top < 0) top = 0;
+	if (right > fb->width) right = fb->width;
+	if (bottom > fb->height) bottom = fb->height;
+
+	for (int y = top; y < bottom; y++)
+		fill_span(fb->pixels + (size_t) y * fb->stride + left, right - left, color);
+}
+
+void blit_rect(struct framebuffer_t *dst, const struct framebuffer_t *src, int left, int top, int right, int bottom)
+{
+	if (left < 0) left = 0;
+	if (top < 0) top = 0;
+	if (right > dst->width) right = dst->width;
+	if (bottom > dst->height) bottom = dst->height;
+
+	for (int y = top; y < bottom; y++)
+		copy_span(dst->pixels + (size_t) y * dst->stride + left, src->pixels + (size_t) y * src->stride + left, right - left);
+}
+
+// EDGE_BUMP - a raised outer bevel around a sunken inner one, each edge pixels wide
+void draw_bump(struct framebuffer_t *fb, int left, int top, int right, int bottom, int edge)
+{
+	for (int layer = 0; layer < 2; layer++)
+	{
+		DWORD light = layer ? PIXEL_SHADOW : PIXEL_WHITE;
+		DWORD dark = layer ? PIXEL_WHITE : PIXEL_DKSHADOW;
+		int l = left + layer * edge, t = top + layer * edge, r = right - layer * edge, b = bottom - layer * edge;
+
+		fill_rect(fb, l, b - edge, r, b, dark);
+		fill_rect(fb, r - edge, t, r, b, dark);
+		fill_rect(fb, l, t, r, t + edge, light);
+		fill_rect(fb, l, t, l + edge, b, light);
+	}
+}
+
+int text_width(const char *text, int scale)
+{
+	int length = (int) strlen(text);
+	return length ? (length * 6 - 1) * scale : 0;
+}
+
+void draw_text(struct framebuffer_t *fb, int x, int y, const char *text, int scale, DWORD color)
+{
+	for (; *text; text++, x += 6 * scale)
+	{
+		const char *found = strchr(font_chars, toupper((unsigned char) *text));
+		if (!found || *text == ' ')
+			continue;
+
+		const BYTE *glyph = font_glyphs[found - font_chars];
+		for (int row = 0; row < 7; row++)
+		{
+			for (int col = 0; col < 5; col++)
+			{
+				if (glyph[row] & (0x10 >> col))
+					fill_rect(fb, x + col * scale, y + row * scale, x + (col + 1) * scale, y + (row + 1) * scale, color);
+			}
+		}
+	}
+}
+
+// boxes of the info panel, in bricks: Next, Level, Lines, Score
+const int PANEL_BOX_TOP[4] = { 2, 9, 13, 17 };
+const int PANEL_BOX_BOTTOM[4] = { 7, 11, 15, 19 };
+const char *PANEL_LABEL[4] = { "Next", "Level", "Lines", "Score" };
+
+void raster_background(struct raster_t *raster)
+{
+	struct framebuffer_t *fb = &raster->background;
+	int bw = raster->brick_width, bh = raster->brick_height, edge = raster->edge;
+
+	fill_rect(fb, 0, 0, bw * (FIELD_WIDTH - 2), bh * (FIELD_HEIGHT - 1), PIXEL_BLACK);
+	fill_rect(fb, bw * (FIELD_WIDTH - 2), 0, bw * (FIELD_WIDTH + INFO_WIDTH - 1), bh * (FIELD_HEIGHT - 1), PIXEL_LTGRAY);
+	draw_bump(fb, bw * (FIELD_WIDTH - 2), 0, bw * (FIELD_WIDTH + INFO_WIDTH - 1), bh * (FIELD_HEIGHT - 1), edge);
+
+	for (int box = 0; box < 4; box++)
+	{
+		int left = bw * (FIELD_WIDTH - 1), right = bw * (FIELD_WIDTH + 4);
+		int top = bh * PANEL_BOX_TOP[box], bottom = bh * PANEL_BOX_BOTTOM[box];
+
+		fill_rect(fb, left, top, right, bottom, PIXEL_BLACK);
+		draw_bump(fb, left - 2 * edge, top - 2 * edge, right + 2 * edge, bottom + 2 * edge, edge);
+
+		int scale = raster->text_scale;
+		draw_text(fb, (left + right) / 2 - text_width(PANEL_LABEL[box], scale) / 2, top - 2 * edge - 8 * scale, PANEL_LABEL[box], scale, PIXEL_LABEL);
+	}
+
+	const char *help[] = { "F1 - Help", "F2 - Hall of Fame", "F3 - About", "Space - Start", "ESC - Exit" };
+	int scale = (raster->text_scale + 1) / 2;
+	int left = bw * (FIELD_WIDTH - 2), right = bw * (FIELD_WIDTH + INFO_WIDTH - 1);
+	int y = bh * 20 + 4 * edge;
+
+	for (int line = 0; line < 5; line++, y += 9 * scale)
+		draw_text(fb, (left + right) / 2 - text_width(help[line], scale) / 2, y, help[line], scale, PIXEL_HELP);
+}
+
+void raster_destroy(struct raster_t *raster)
+{
+	framebuffer_destroy(&raster->frame);
+	framebuffer_destroy(&raster->background);
+}
+
+BOOL raster_create(struct raster_t *raster, int brick_width, int brick_height)
+{
+	ZeroMemory(raster, sizeof(struct raster_t));
+
+	raster->brick_width = brick_width;
+	raster->brick_height = brick_height;
+	raster->edge = (brick_width + 15) / 16;
+	raster->text_scale = (brick_height + 7) / 8;
+
+	int width = brick_width * (FIELD_WIDTH + INFO_WIDTH - 1), height = brick_height * (FIELD_HEIGHT - 1);
+	if (!framebuffer_create(&raster->frame, width, height) || !framebuffer_create(&raster->background, width, height))
+	{
+		raster_destroy(raster);
+		return FALSE;
+	}
+
+	raster_background(raster);
+	return TRUE;
+}
+
+inline void raster_cell(struct raster_t *raster, int row, int col, BYTE color)
+{
+	int bw = raster->brick_width, bh = raster->brick_height, gap = raster->edge;
+	int left = bw * (col - 1), top = bh * row;
+
+	fill_rect(&raster->frame, left + gap, top + gap, left + bw - gap, top + bh - gap, pixel_from_color(color_value[color]));
+}
+
+void raster_counter(struct raster_t *raster, int box, int value)
+{
+	int bw = raster->brick_width, bh = raster->brick_height, scale = raster->text_scale;
+	int left = bw * (FIELD_WIDTH - 1), right = bw * (FIELD_WIDTH + 4);
+	int top = bh * PANEL_BOX_TOP[box], bottom = bh * PANEL_BOX_BOTTOM[box];
+
+	char text[16];
+	sprintf_s(text, sizeof(text), "%06d", value);
+
+	blit_rect(&raster->frame, &raster->background, left, top, right, bottom);
+
+	// the digits are clipped to the box, at small bricks they are wider than it and would
+	// leave pixels outside that the next redraw of the box doesn't clear
+	struct framebuffer_t inside = raster->frame;
+	inside.pixels += (size_t) top * inside.stride + left;
+	inside.width = right - left, inside.height = bottom - top;
+
+	draw_text(&inside, (right - left) / 2 - text_width(text, scale) / 2, (bottom - top) / 2 - 7 * scale / 2, text, scale, PIXEL_WHITE);
+}
+
+// a full redraw in one pass, so each pixel is written once - the cells of the well are filled
+// span by span and only the gaps between them and the panel are copied from the background
+void raster_full(struct raster_t *raster, const struct frame_t *frame)
+{
+	struct framebuffer_t *fb = &raster->frame;
+	int bw = raster->brick_width, bh = raster->brick_height, gap = raster->edge;
+	int well = bw * (FIELD_WIDTH - 2);
+
+	for (int y = 0; y < fb->height; y++)
+	{
+		DWORD *dst = fb->pixels + (size_t) y * fb->stride;
+		const DWORD *src = raster->background.pixels + (size_t) y * fb->stride;
+		int row = y / bh, inside = y % bh;
+
+		if (inside < gap || inside >= bh - gap)
+			copy_span(dst, src, well);
+		else
+		{
+			for (int left = 0, col = 1; col < FIELD_WIDTH - 1; col++, left += bw)
+			{
+				copy_span(dst + left, src + left, gap);
+				fill_span(dst + left + gap, bw - 2 * gap, pixel_from_color(color_value[frame->field[row][col]]));
+				copy_span(dst + left + bw - gap, src + left + bw - gap, gap);
+			}
+		}
+
+		copy_span(dst + well, src + well, fb->width - well);
+	}
+
+	for (int row = 2; row < 7; row++)
+	{
+		for (int col = 12; col < 17; col++)
+			raster_cell(raster, row, col, frame->field[row][col]);
+	}
+}
+
+// draws the frame, redrawing only what differs from the previously rendered one
+void raster_render(struct raster_t *raster, const struct frame_t *frame)
+{
+	BOOL full = !raster->fValid;
+
+	if (full)
+		raster_full(raster, frame);
+	else
+	{
+		for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+		{
+			for (int col = 1; col < FIELD_WIDTH + INFO_WIDTH - 1; col++)
+			{
+				BOOL visible = (col < FIELD_WIDTH - 1) || (row >= 2 && row < 7 && col >= 12 && col < 17);
+
+				if (visible && frame->field[row][col] != raster->shown.field[row][col])
+					raster_cell(raster, row, col, frame->field[row][col]);
+			}
+		}
+	}
+
+	if (full || frame->level != raster->shown.level)
+		raster_counter(raster, 1, frame->level);
+	if (full || frame->total_rows != raster->shown.total_rows)
+		raster_counter(raster, 2, frame->total_rows);
+	if (full || frame->score != raster->shown.score)
+		raster_counter(raster, 3, frame->score);
+
+	raster->shown = *frame;
+	raster->fValid = TRUE;
+}
+
+// 32 bit top down BMP, byte order B G R A exactly as the pixels sit in memory
+BOOL raster_write_bmp(const struct framebuffer_t *fb, const char *path)
+{
+	FILE *file = NULL;
+	if (fopen_s(&file, path, "wb") != 0 || !file)
+		return FALSE;
+
+	DWORD image = (DWORD) fb->width * fb->height * 4;
+	BYTE header[54] = { 'B', 'M' };
+	DWORD fields[] = { 54 + image, 0, 54, 40, (DWORD) fb->width, (DWORD) -fb->height, 1 | (32 << 16), 0, image, 2835, 2835, 0, 0 };
+	memcpy(header + 2, fields, sizeof(fields));
+
+	BOOL result = fwrite(header, sizeof(header), 1, file) == 1;
+	for (int y = 0; result && y < fb->height; y++)
+		result = fwrite(fb->pixels + (size_t) y * fb->stride, sizeof(DWORD), fb->width, file) == (size_t) fb->width;
+
+	fclose(file);
+	return result;
+}
+
+// pixels that differ from a golden image written by raster_write_bmp, -1 if it cannot be read
+int raster_compare_bmp(const struct framebuffer_t *fb, const char *path)
+{
+	struct mapped_file_t mapped;
+	if (!map_file(&mapped, path))
+		return -1;
+
+	int result = -1;
+	const BYTE *data = mapped.data;
+
+	if (mapped.size >= 54 && data[0] == 'B' && data[1] == 'M')
+	{
+		DWORD offset, width, bits;
+		memcpy(&offset, data + 10, 4);
+		memcpy(&width, data + 18, 4);
+		int height;
+		memcpy(&height, data + 22, 4);
+		bits = data[28] | (data[29] << 8);
+
+		if ((int) width == fb->width && -height == fb->height && bits == 32 && offset + (ULONGLONG) width * fb->height * 4 <= mapped.size)
+		{
+			result = 0;
+
+			for (int y = 0; y < fb->height; y++)
+			{
+				const BYTE *row = data + offset + (size_t) y * width * 4;
+				for (int x = 0; x < fb->width; x++)
+				{
+					DWORD pixel;
+					memcpy(&pixel, row + x * 4, 4);
+
+					if (pixel != fb->pixels[(size_t) y * fb->stride + x])
+						result++;
+				}
+			}
+		}
+	}
+
+	unmap_file(&mapped);
+	return result;
+}
+
+#ifdef _WIN32
+HANDLE hFrameReady = NULL;
+
+void draw_field(HDC hdc, const struct frame_t *frame)
+{
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+	{
+		for (int col = 1; col < FIELD_WIDTH - 1; col++)
+		{
+			FillRect(hdc, &field_rect[row][col], brush_index[frame->field[row][col]]);
+		}
+	}
+
+	for (int row = 2; row < 7; row++)
+	{
+		for (int col = 12; col < 17; col++)
+		{
+			FillRect(hdc, &field_rect[row][col], brush_index[frame->field[row][col]]);
+		}
+	}
+}
+
+void update_hud(const struct frame_t *frame)
+{
+	if (NULL != szLevel)
+	{
+		ZeroMemory(szLevel, sizeof(TCHAR) * STRING_BUFFER_SIZE);
+		_stprintf_s(szLevel, STRING_BUFFER_SIZE, TEXT("%0.6d"), frame->level);
+	}
+
+	if (NULL != szScore)
+	{
+		ZeroMemory(szScore, sizeof(TCHAR) * STRING_BUFFER_SIZE);
+		_stprintf_s(szScore, STRING_BUFFER_SIZE, TEXT("%0.6d"), frame->score);
+	}
+
+	if (NULL != szRows)
+	{
+		ZeroMemory(szRows, sizeof(TCHAR) * STRING_BUFFER_SIZE);
+		_stprintf_s(szRows, STRING_BUFFER_SIZE, TEXT("%0.6d"), frame->total_rows);
+	}
+}
+
+void render_frame(const struct frame_t *frame)
+{
+	BitBlt(hdcBuffer, 0, 0, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1), hdcBackground, 0, 0, SRCCOPY);
+	
+	draw_field(hdcBuffer, frame);
+	update_hud(frame);
+	
+	if (NULL != szLevel)
+	{
+		TextOut(hdcBuffer, BRICK_WIDTH * (FIELD_WIDTH - 1) + text_offset_x, BRICK_HEIGHT * 9 + text_offset_y, szLevel, static_cast<int>(_tcslen(szLevel)));
+	}
+
+	if (NULL != szRows)
+	{
+		TextOut(hdcBuffer, BRICK_WIDTH * (FIELD_WIDTH - 1) + text_offset_x, BRICK_HEIGHT * 13 + text_offset_y, szRows, static_cast<int>(_tcslen(szRows)));
+	}
+
+	if (NULL != szScore)
+	{
+		TextOut(hdcBuffer, BRICK_WIDTH * (FIELD_WIDTH - 1) + text_offset_x, BRICK_HEIGHT * 17 + text_offset_y, szScore, static_cast<int>(_tcslen(szScore)));
+	}
+
+	BitBlt(g_hdc, 0, 0, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1), hdcBuffer, 0, 0, SRCCOPY);	
+}
+
+void process_input(void)
+{
+	static SHORT LastKeyPressed = 0;
+	static DWORD StartTime = 0;
+
+	if (LastKeyPressed)
+	{
+		if (GetAsyncKeyState(LastKeyPressed) & 0x8000)
+		{
+			if ((timeGetTime() - StartTime) >= 175)
+			{
+				LastKeyPressed = 0;
+			}
+			else
+			{
+				return;
+			}
+		}
+		else
+		{
+			LastKeyPressed = 0;
+		}
+	}
+
+	if ((GetAsyncKeyState(VK_SPACE) & 0x8000) && !game.fStart)
+	{
+		play_action(ACTION_START);
+
+		LastKeyPressed = VK_SPACE;
+	}
+	else if ((GetAsyncKeyState(VK_UP) & 0x8000) && game.fStart)
+	{
+		play_action(ACTION_ROTATE);
+
+		LastKeyPressed = VK_UP;
+	}
+	else if ((GetAsyncKeyState(VK_RIGHT) & 0x8000) && game.fStart)
+	{
+		play_action(ACTION_RIGHT);
+
+		LastKeyPressed = VK_RIGHT;
+	}
+	else if ((GetAsyncKeyState(VK_LEFT) & 0x8000) && game.fStart)
+	{
+		play_action(ACTION_LEFT);
+
+		LastKeyPressed = VK_LEFT;
+	}
+	else if ((GetAsyncKeyState(VK_DOWN) & 0x8000) && game.fStart)
+	{
+		play_action(ACTION_DROP);
+
+		LastKeyPressed = VK_DOWN;
+	}
+	else if (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
+	{
+		PostMessage(g_hWnd, WM_CLOSE, 0, 0);
+	}
+
+	if (LastKeyPressed)
+	{
+		StartTime = timeGetTime();
+	}
+}
+
+// the simulation and the renderer each run on their own thread, the window thread only pumps
+// messages and runs the dialogs. keys are ignored while a dialog is up but gravity keeps going
+const UINT WM_GAMEOVER = WM_APP + 1;
+
+int final_score = 0;
+std::thread simulation, renderer;
+
+void simulation_thread(void)
+{
+	while (fRunning)
+	{
+		if (fActive)
+		{
+			if (!fDialog)
+				process_input();
+
+			// one step whenever gravity is due, however many rows it moves
+			if (game.fStart && (int) (timeGetTime() - game_start_time - game_gravity_due(&game)) >= 0)
+			{
+				if (play_action(ACTION_GRAVITY) & GAME_OVER)
+					PostMessage(g_hWnd, WM_GAMEOVER, 0, (LPARAM) game.score);
+			}
+		}
+
+		if (fDirty)
+		{
+			fDirty = FALSE;
+			frame_publish(&game);
+			SetEvent(hFrameReady);
+		}
+
+		Sleep(1);
+	}
+}
+
+// -software draws with the raster code and presents the whole buffer, so a repaint after
+// the window was covered needs nothing more than the next present
+void present_raster(const struct raster_t *raster)
+{
+	BITMAPINFO bmi;
+	ZeroMemory(&bmi, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = raster->frame.stride;
+	bmi.bmiHeader.biHeight = -raster->frame.height;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	SetDIBitsToDevice(g_hdc, 0, 0, raster->frame.width, raster->frame.height, 0, 0, 0, raster->frame.height, raster->frame.pixels, &bmi, DIB_RGB_COLORS);
+}
+
+void render_thread(void)
+{
+	struct raster_t raster;
+	BOOL fRaster = fSoftware && raster_create(&raster, BRICK_WIDTH, BRICK_HEIGHT);
+
+	while (fRunning)
+	{
+		WaitForSingleObject(hFrameReady, 100);
+
+		if (fRaster)
+		{
+			raster_render(&raster, frame_acquire());
+			present_raster(&raster);
+		}
+		else
+			render_frame(frame_acquire());
+	}
+
+	if (fRaster)
+		raster_destroy(&raster);
+}
+
+void start_threads(void)
+{
+	hFrameReady = CreateEvent(NULL, FALSE, TRUE, NULL);
+	frame_init(&game);
+
+	fRunning = true;
+	simulation = std::thread(simulation_thread);
+	renderer = std::thread(render_thread);
+}
+
+void stop_threads(void)
+{
+	if (!fRunning)
+		return;
+
+	fRunning = false;
+	SetEvent(hFrameReady);
+
+	simulation.join();
+	renderer.join();
+
+	CloseHandle(hFrameReady);
+	hFrameReady = NULL;
+}
+
+INT_PTR show_dialog(WORD id, DLGPROC proc)
+{
+	fDialog = TRUE;
+	INT_PTR result = DialogBox(g_hInstance, MAKEINTRESOURCE(id), g_hWnd, proc);
+	fDialog = FALSE;
+
+	return result;
+}
+
+unsigned long hash_time(void)
+{
+	unsigned long hash = 0, now = GetTickCount();
+	char *p = (char *)&now;
+	
+	for (int i = 0; i < sizeof(unsigned long); i++)
+		hash = hash * (2U * CHAR_MAX) + *p++;
+
+	return hash;
+}
+
+void read_hof(void)
+{
+	HKEY hKey;
+	DWORD dwDisp;
+
+	RegCreateKeyEx(HKEY_CURRENT_USER, TEXT("Tetris"), 0, TEXT(""), 0, KEY_READ | KEY_WRITE, NULL, &hKey, &dwDisp);
+
+	if (dwDisp == REG_CREATED_NEW_KEY)
+	{
+		ZeroMemory(&hall_of_fame, sizeof(struct score_t) * 3);
+			
+		TCHAR szText[] = TEXT(".......");
+		for (int i = 0; i < 3; i++)
+		{
+			_tcscpy_s(hall_of_fame[i].name, SCORE_MAX_NAME, szText);				
+			hall_of_fame[i].score = 0;
+		}
+	
+		RegSetValueEx(hKey, NULL, 0, REG_BINARY, (PBYTE)&hall_of_fame, sizeof(struct score_t) * 3);
+	}
+	else
+	{
+		DWORD size = sizeof(struct score_t) * 3;
+		RegQueryValueEx(hKey, NULL, NULL, NULL, (PBYTE)&hall_of_fame, &size);
+	}
+
+	RegCloseKey(hKey);
+}
+
+void write_hof(void)
+{
+	HKEY hKey;
+	DWORD dwDisp;
+
+	RegCreateKeyEx(HKEY_CURRENT_USER, TEXT("Tetris"), 0, TEXT(""), 0, KEY_READ | KEY_WRITE, NULL, &hKey, &dwDisp);
+
+	if (dwDisp == REG_CREATED_NEW_KEY)
+	{
+		ZeroMemory(&hall_of_fame, sizeof(struct score_t) * 3);
+			
+		TCHAR szText[] = TEXT(".......");
+		for (int i = 0; i < 3; i++)
+		{
+			_tcscpy_s(hall_of_fame[i].name, SCORE_MAX_NAME, szText);				
+			hall_of_fame[i].score = 0;
+		}
+	}
+
+	RegSetValueEx(hKey, NULL, 0, REG_BINARY, (PBYTE)&hall_of_fame, sizeof(struct score_t) * 3);
+	RegCloseKey(hKey);
+}
+
+BOOL CALLBACK HOFDlgProc(HWND hWndDlg, UINT message, WPARAM wParam, LPARAM lParam) 
+{ 
+    switch (message) 
+    { 
+	case WM_INITDIALOG:
+		{
+#pragma warning( disable : 4311 ) // 'type cast' : pointer truncation from 'HICON' to 'LONG'
+			SetClassLong(hWndDlg, GCL_HICON, (LONG) LoadIcon(g_hInstance, MAKEINTRESOURCE(IDI_TETRIS)));
+#pragma warning( default : 4311 )
+
+			SetDlgItemText(hWndDlg, IDC_HOFNAME1, hall_of_fame[0].name);
+			SetDlgItemText(hWndDlg, IDC_HOFNAME2, hall_of_fame[1].name);
+			SetDlgItemText(hWndDlg, IDC_HOFNAME3, hall_of_fame[2].name);
+	
+			ZeroMemory(szBuffer, STRING_BUFFER_SIZE);
+			_stprintf_s(szBuffer, STRING_BUFFER_SIZE, TEXT("%d"), hall_of_fame[0].score);
+			SetDlgItemText(hWndDlg, IDC_HOFSCORE1, szBuffer);
+
+			ZeroMemory(szBuffer, STRING_BUFFER_SIZE);
+			_stprintf_s(szBuffer, STRING_BUFFER_SIZE, TEXT("%d"), hall_of_fame[1].score);
+			SetDlgItemText(hWndDlg, IDC_HOFSCORE2, szBuffer);
+
+			ZeroMemory(szBuffer, STRING_BUFFER_SIZE);
+			_stprintf_s(szBuffer, STRING_BUFFER_SIZE, TEXT("%d"), hall_of_fame[2].score);
+			SetDlgItemText(hWndDlg, IDC_HOFSCORE3, szBuffer);
+			
+			return TRUE;
+		}
+    case WM_COMMAND:
+		{
+			switch (LOWORD(wParam)) 
+			{ 
+				case IDOK:
+					{
+						EndDialog(hWndDlg, wParam); 
+						return TRUE;
+					}
+			} 
+		}
+	} 
+
+    return FALSE; 
+} 
+
+BOOL CALLBACK OkDlgProc(HWND hWndDlg, UINT message, WPARAM wParam, LPARAM lParam) 
+{ 
+    switch (message) 
+    {
+		case WM_INITDIALOG:
+		{
+#pragma warning( disable : 4311 ) // 'type cast' : pointer truncation from 'HICON' to 'LONG'
+			SetClassLong(hWndDlg, GCL_HICON, (LONG) LoadIcon(g_hInstance, MAKEINTRESOURCE(IDI_TETRIS)));
+#pragma warning( default : 4311 )
+			return TRUE;
+		}
+        case WM_COMMAND:
+			{
+				switch (LOWORD(wParam)) 
+				{ 
+					case IDOK:
+						{
+							EndDialog(hWndDlg, wParam); 
+							return TRUE;
+						}
+				} 
+			}
+	} 
+
+    return FALSE; 
+} 
+
+BOOL validate_name(PTCHAR szBuffer)
+{
+	BOOL result = FALSE;
+
+	if (!szBuffer) 
+		return result;
+
+	size_t idx = 0;
+	size_t len = _tcslen(szBuffer);
+		
+	while (idx < len)
+	{
+		if (!_istspace(szBuffer[idx]))
+		{
+			result = TRUE;
+			break;			
+		}
+
+		idx++;
+	}
+
+	return result;
+}
+
+BOOL CALLBACK NameDlgProc(HWND hWndDlg, UINT message, WPARAM wParam, LPARAM lParam) 
+{ 
+    switch (message) 
+    { 
+	case WM_INITDIALOG:
+		{
+#pragma warning( disable : 4311 ) // 'type cast' : pointer truncation from 'HICON' to 'LONG'
+			SetClassLong(hWndDlg, GCL_HICON, (LONG) LoadIcon(g_hInstance, MAKEINTRESOURCE(IDI_TETRIS)));
+#pragma warning( default : 4311 )
+
+			if (GetDlgCtrlID((HWND) wParam) != IDC_NAME) 
+			{ 
+				SetFocus(GetDlgItem(hWndDlg, IDC_NAME)); 
+				return FALSE; 
+			}
+			
+			return TRUE;
+		}
+    case WM_COMMAND:
+		{
+			switch (LOWORD(wParam)) 
+			{ 
+				case IDOK:
+					{
+						ZeroMemory(szBuffer, STRING_BUFFER_SIZE);
+						GetDlgItemText(hWndDlg, IDC_NAME, szBuffer, SCORE_MAX_NAME);
+
+						if (!validate_name(szBuffer))
+						{
+							MessageBox(NULL, TEXT("Please enter your name."), TEXT("Tetris"), MB_OK);
+							return FALSE;
+						}
+
+						if (final_score > hall_of_fame[0].score)
+						{
+							hall_of_fame[2] = hall_of_fame[1];
+							hall_of_fame[1] = hall_of_fame[0];
+							_tcscpy_s(hall_of_fame[0].name, SCORE_MAX_NAME, szBuffer);
+							hall_of_fame[0].score = final_score;
+						}
+						else if (final_score > hall_of_fame[1].score)
+						{
+							hall_of_fame[2] = hall_of_fame[1];
+							_tcscpy_s(hall_of_fame[1].name, SCORE_MAX_NAME, szBuffer);
+							hall_of_fame[1].score = final_score;
+						}
+						else if (final_score > hall_of_fame[2].score)
+						{
+							_tcscpy_s(hall_of_fame[2].name, SCORE_MAX_NAME, szBuffer);
+							hall_of_fame[2].score = final_score;
+						}
+
+						write_hof();
+						EndDialog(hWndDlg, wParam); 
+						return TRUE;
+					}
+			} 
+		}
+	} 
+
+    return FALSE; 
+} 
+
+LRESULT CALLBACK WndProc(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
+{
+	static TIMECAPS tc;
+	static HFONT hFont;
+	static HGDIOBJ hPrevObject;
+
+	switch (Msg)
+	{
+	case WM_ACTIVATEAPP:
+		{
+			fActive = (BOOL) wParam;
+			return 0L;
+		}
+	case WM_KEYDOWN:
+		{
+			switch (wParam)
+			{
+			case VK_F1:
+				{
+					show_dialog(DLG_HELP, (DLGPROC)OkDlgProc);
+					break;
+				}
+			case VK_F2:
+				{
+					show_dialog(DLG_HOF, (DLGPROC)HOFDlgProc);
+					break;
+				}
+			case VK_F3:
+				{
+					show_dialog(DLG_ABOUT, (DLGPROC)OkDlgProc);
+					break;
+				}
+			}
+			return 0L;
+		}
+	case WM_GAMEOVER:
+		{
+			final_score = (int) lParam;
+
+			if (final_score > hall_of_fame[2].score)
+			{
+				show_dialog(DLG_NAME, (DLGPROC)NameDlgProc);
+				show_dialog(DLG_HOF, (DLGPROC)HOFDlgProc);
+			}
+			return 0L;
+		}
+	case WM_CREATE:
+		{			
+			szBuffer = new TCHAR[STRING_BUFFER_SIZE];
+			szLevel = new TCHAR[STRING_BUFFER_SIZE];
+			szRows = new TCHAR[STRING_BUFFER_SIZE];
+			szScore = new TCHAR[STRING_BUFFER_SIZE];
+
+			if (!szBuffer || !szLevel || !szRows || !szScore)
+			{				
+				return -1;
+			}
+
+			if (NULL != szLevel) 
+			{
+				ZeroMemory(szLevel, sizeof(TCHAR) * STRING_BUFFER_SIZE);
+				_stprintf_s(szLevel, STRING_BUFFER_SIZE, TEXT("%0.6d"), 0);
+			}
+
+			if (NULL != szRows) 
+			{
+				ZeroMemory(szRows, sizeof(TCHAR) * STRING_BUFFER_SIZE);
+				_stprintf_s(szRows, STRING_BUFFER_SIZE, TEXT("%0.6d"), 0);
+			}
+
+			if (NULL != szScore)
+			{
+				ZeroMemory(szScore, sizeof(TCHAR) * STRING_BUFFER_SIZE);
+				_stprintf_s(szScore, STRING_BUFFER_SIZE, TEXT("%0.6d"), 0);
+			}
+
+			read_hof();
+
+			timeGetDevCaps(&tc, sizeof(TIMECAPS));
+			timeBeginPeriod(tc.wPeriodMin);
+			
+			struct piece_stream_t stream;
+			piece_stream_init(&stream, hash_time(), 0, PIECE_UNIFORM);
+
+			telemetry_start("tetris");
+			replay_create(&replay, "tetris.trp");
+
+			if (fExport && dataset_open(&dataset, "tetris", 0, 1))
+				sample_producer_init(&player_samples, &dataset, 0);
+			else
+				fExport = FALSE;
+
+			for (int i = 0; i < COLOR_COUNT; i++)
+			{
+				brush_index[i] = CreateSolidBrush(color_value[i]);
+			}
+
+			make_field(-BRICK_WIDTH, 0);
+
+			game_init(&game, &stream);
+			game.fTelemetry = TRUE;
+
+			// create double buffer
+			{
+				HDC hdc = GetDC(hWnd);
+
+				hdcBuffer = CreateCompatibleDC(hdc);			
+				hbmBuffer = CreateCompatibleBitmap(hdc, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
+				SelectObject(hdcBuffer, hbmBuffer);
+
+				hdcBackground = CreateCompatibleDC(hdc);
+				hbmBackground = CreateCompatibleBitmap(hdc, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
+				SelectObject(hdcBackground, hbmBackground);
+
+				ReleaseDC(hWnd, hdc);
+			}
+
+			// basic layout
+			{
+				RECT r;
+				SetRect(&r, 0, 0, BRICK_WIDTH * (FIELD_WIDTH - 2), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
+				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
+				
+				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 2), 0, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
+				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(LTGRAY_BRUSH));
+				
+				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
+
+				hFont = CreateFont(-MulDiv(14, GetDeviceCaps(hdcBackground, LOGPIXELSY), 72), 0, 0, 0, 700, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_TT_ONLY_PRECIS, CLIP_DEFAULT_PRECIS, NONANTIALIASED_QUALITY, DEFAULT_PITCH, TEXT("Comic Sans MS"));
+				hPrevObject = SelectObject(hdcBackground, hFont);
+
+				SetBkMode(hdcBackground, TRANSPARENT);
+				SetTextColor(hdcBackground, RGB(255, 0, 0));
+			}
+
+			// next
+			{
+				RECT r;
+				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 1), BRICK_HEIGHT * 2, BRICK_WIDTH * (FIELD_WIDTH + 4), BRICK_HEIGHT * (7));
+				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
+				
+				InflateRect(&r, 2, 2);
+
+				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
+
+				SIZE s;
+				TCHAR szText[] = TEXT("Next");
+				
+				GetTextExtentPoint32(hdcBackground, szText, ARRAYSIZE(szText) - 1, &s);
+				TextOut(hdcBackground, (r.left + (r.right - r.left) / 2) - (s.cx / 2), r.top - s.cy, szText, static_cast<int>(_tcslen(szText)));
+			}
+
+			// level
+			{
+				RECT r;
+				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 1), BRICK_HEIGHT * 9, BRICK_WIDTH * (FIELD_WIDTH + 4), BRICK_HEIGHT * (11));
+				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
+				
+				InflateRect(&r, 2, 2);
+
+				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
+
+				SIZE s;
+				TCHAR szText[] = TEXT("Level");
+				
+				GetTextExtentPoint32(hdcBackground, szText, ARRAYSIZE(szText) - 1, &s);
+				TextOut(hdcBackground, (r.left + (r.right - r.left) / 2) - (s.cx / 2), r.top - s.cy, szText, static_cast<int>(_tcslen(szText)));
+			}
+			
+			// lines
+			{
+				RECT r;
+				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 1), BRICK_HEIGHT * 13, BRICK_WIDTH * (FIELD_WIDTH + 4), BRICK_HEIGHT * (15));
+				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
+				
+				InflateRect(&r, 2, 2);
+
+				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
+
+				SIZE s;
+				TCHAR szText[] = TEXT("Lines");
+				
+				GetTextExtentPoint32(hdcBackground, szText, ARRAYSIZE(szText) - 1, &s);
+				TextOut(hdcBackground, (r.left + (r.right - r.left) / 2) - (s.cx / 2), r.top - s.cy, szText, static_cast<int>(_tcslen(szText)));
+			}
+		
+			// score
+			{
+				RECT r;
+				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 1), BRICK_HEIGHT * 17, BRICK_WIDTH * (FIELD_WIDTH + 4), BRICK_HEIGHT * (19));
+				FillRect(hdcBackground, &r, (HBRUSH) GetStockObject(BLACK_BRUSH));
+				
+				InflateRect(&r, 2, 2);
+
+				DrawEdge(hdcBackground, &r, EDGE_BUMP, BF_RECT);
+
+				SIZE s;
+				TCHAR szText[] = TEXT("Score");
+				
+				GetTextExtentPoint32(hdcBackground, szText, ARRAYSIZE(szText) - 1, &s);
+				TextOut(hdcBackground, (r.left + (r.right - r.left) / 2) - (s.cx / 2), r.top - s.cy, szText, static_cast<int>(_tcslen(szText)));
+			}
+
+			DeleteObject(hFont);
+			SelectObject(hdcBackground, hPrevObject);
+
+			hFont = CreateFont(-MulDiv(8, GetDeviceCaps(hdcBackground, LOGPIXELSY), 72), 0, 0, 0, 700, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_TT_ONLY_PRECIS, CLIP_DEFAULT_PRECIS, NONANTIALIASED_QUALITY, DEFAULT_PITCH, TEXT("Comic Sans MS"));
+			hPrevObject = SelectObject(hdcBackground, hFont);
+
+			{
+				RECT r;
+				SetRect(&r, BRICK_WIDTH * (FIELD_WIDTH - 2), BRICK_HEIGHT * 20 + 4, BRICK_WIDTH * (FIELD_WIDTH + 5), BRICK_HEIGHT * (28));
+
+				TCHAR szText[] = TEXT("F1 - Help\nF2 - Hall of Fame\nF3 - About\nSpace - Start\nESC - Exit");
+				SetTextColor(hdcBackground, RGB(0, 0, 255));
+				DrawText(hdcBackground, szText, ARRAYSIZE(szText) - 1, &r, DT_CENTER | DT_VCENTER | DT_WORDBREAK);
+			}
+
+			DeleteObject(hFont);
+			SelectObject(hdcBackground, hPrevObject);
+
+			hFont = CreateFont(-MulDiv(14, GetDeviceCaps(hdcBackground, LOGPIXELSY), 72), 0, 0, 0, 700, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_TT_ONLY_PRECIS, CLIP_DEFAULT_PRECIS, NONANTIALIASED_QUALITY, DEFAULT_PITCH, TEXT("Comic Sans MS"));
+			hPrevObject = SelectObject(hdcBuffer, hFont);
+
+			{
+				TCHAR szText[7] = TEXT("000000");
+				SIZE s;
+				GetTextExtentPoint32(hdcBuffer, szText, ARRAYSIZE(szText) - 1, &s);
+				text_offset_x = ((((BRICK_WIDTH * (FIELD_WIDTH + 4)) - (BRICK_WIDTH * (FIELD_WIDTH - 1))) - s.cx) / 2);
+				text_offset_y = (((BRICK_HEIGHT * 2) - s.cy) / 2);
+			}
+			
+			SetBkMode(hdcBuffer, TRANSPARENT);
+			SetTextColor(hdcBuffer, RGB(255, 255, 255));
+
+			return 0;
+		}
+	case WM_CLOSE:
+		{
+			fDialog = TRUE;
+			int answer = MessageBox(hWnd, TEXT("Exit?"), TEXT("Tetris"), MB_YESNO);
+			fDialog = FALSE;
+
+			if (answer == IDYES)
+				DestroyWindow(hWnd);
+			
+			return 0;
+		}
+	case WM_PAINT:
+		{
+			PAINTSTRUCT ps;
+			BeginPaint(hWnd, &ps);
+			EndPaint(hWnd, &ps);
+
+			// the render thread repaints the whole window on its next pass
+			if (hFrameReady)
+				SetEvent(hFrameReady);
+			return 0L;
+		}
+	case WM_DESTROY:
+		{
+			stop_threads();
+
+			delete szBuffer;			
+			delete szLevel;
+			delete szRows;
+			delete szScore;
+
+			szBuffer = NULL;
+			szLevel = NULL;
+			szRows = NULL;
+			szScore = NULL;
+
+			timeEndPeriod(tc.wPeriodMin);
+
+			if (!replay_close(&replay, &game))
+				MessageBox(NULL, TEXT("The replay could not be saved."), TEXT("Tetris"), MB_OK);
+			telemetry_stop();
+			telemetry_free();
+
+			if (fExport)
+			{
+				if (game.fStart)
+					sample_truncate(&player_samples, &game);
+				sample_producer_close(&player_samples);
+				dataset_close(&dataset);
+			}
+
+			for (int i = 0; i < COLOR_COUNT; i++)
+			{
+				DeleteObject(brush_index[i]);
+			}
+
+			DeleteObject(hFont);
+			SelectObject(hdcBackground, hPrevObject);
+			
+			DeleteObject(hbmBackground);
+			DeleteDC(hdcBackground);
+
+			DeleteObject(hbmBuffer);
+			DeleteDC(hdcBuffer);
+
+			PostQuitMessage(0);
+			return 0;
+		}
+	}
+	return DefWindowProc(hWnd, Msg, wParam, lParam);
+}
+
+int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd)
+{
+	static TCHAR szClassName[] = TEXT("DBEB2C8C-1BCD-409f-985E-276CB19A81B5");
+	static TCHAR szAppName[] = TEXT("Tetris");
+	WNDCLASSEX wcex;
+
+	HANDLE hMutex = CreateMutex(NULL, TRUE, szClassName);	
+	if (ERROR_ALREADY_EXISTS == GetLastError())
+	{
+		MessageBox(NULL, TEXT("Tetris is already running."), szAppName, MB_OK);
+		CloseHandle(hMutex);
+		return 0;
+	}
+
+	g_hInstance = hInstance;
+	fSoftware = (NULL != lpCmdLine) && (NULL != strstr(lpCmdLine, "-software"));
+	fExport = (NULL != lpCmdLine) && (NULL != strstr(lpCmdLine, "-export"));
+
+	wcex.cbClsExtra = 0;
+	wcex.cbSize = sizeof(WNDCLASSEX);
+	wcex.cbWndExtra = 0;
+	wcex.hbrBackground = NULL;
+	wcex.hCursor = LoadCursor(NULL, IDC_ARROW);
+	wcex.hIcon = LoadIcon(hInstance, MAKEINTRESOURCE(IDI_TETRIS));
+	wcex.hIconSm = NULL;
+	wcex.hInstance = hInstance;
+	wcex.lpfnWndProc = WndProc;
+	wcex.lpszClassName = szClassName;
+	wcex.lpszMenuName = NULL;
+	wcex.style = CS_OWNDC;
+
+	if (!RegisterClassEx(&wcex))
+		return 0;
+
+	DWORD dwStyle = WS_POPUP | WS_BORDER | WS_SYSMENU | WS_MINIMIZEBOX | WS_CAPTION;
+	DWORD dwExStyle = 0;
+
+	RECT r, w;
+	SetRect(&r, 0, 0, BRICK_WIDTH * (FIELD_WIDTH + INFO_WIDTH - 1), BRICK_HEIGHT * (FIELD_HEIGHT - 1));
+	AdjustWindowRectEx(&r, dwStyle, FALSE, dwExStyle);
+	SystemParametersInfo(SPI_GETWORKAREA, 0, &w, 0);
+	int width = r.right - r.left;
+	int height = r.bottom - r.top;
+	int x = ((w.right - w.left) / 2) - (width / 2);
+	int y = ((w.bottom - w.top) / 2) - (height / 2);
+
+	g_hWnd = CreateWindowEx(dwExStyle, szClassName, szAppName, dwStyle, x, y, width, height, NULL, NULL, hInstance, 0);
+	if (!g_hWnd)
+		return 0;
+
+	g_hdc = GetDC(g_hWnd);
+
+	ShowWindow(g_hWnd, SW_NORMAL);
+	UpdateWindow(g_hWnd);
+
+	start_threads();
+
+	MSG msg;	
+	while (GetMessage(&msg, NULL, 0, 0) > 0)
+	{
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+
+	ReleaseMutex(hMutex);
+	CloseHandle(hMutex);
+
+	return (int) msg.wParam;
+}
+
+#else
+
+// rows from the top of the stack down to the floor separated by '/', 'X' or '#' is a filled cell
+BOOL parse_board(const char *layout, struct board_t *board)
+{
+	int count = 1;
+	for (const char *c = layout; *c; c++)
+		count += (*c == '/');
+
+	if (count > FIELD_HEIGHT - 1)
+		return FALSE;
+
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+		board->rows[row] = BOARD_EMPTY_ROW;
+	board->rows[FIELD_HEIGHT - 1] = BOARD_FULL_ROW;
+
+	int row = FIELD_HEIGHT - 1 - count, col = 1;
+	for (const char *c = layout; *c; c++)
+	{
+		if (*c == '/')
+			row++, col = 1;
+		else if (col >= FIELD_WIDTH - 1)
+			return FALSE;
+		else if (*c == 'X' || *c == 'x' || *c == '#')
+			board->rows[row] |= 1 << col++;
+		else
+			col++;
+	}
+
+	return TRUE;
+}
+
+void print_solver_stats(const struct solver_stats_t *stats)
+{
+	printf("%llu states in %.3f s, %.0f states/s, %llu probes, %.1f%% hits\n", stats->states, stats->seconds,
+		stats->seconds > 0 ? stats->states / stats->seconds : 0.0, stats->probes, stats->probes ? 100.0 * stats->hits / stats->probes : 0.0);
+}
+
+int solve(const char *layout, const char *queue, int survive, int threads, int memory)
+{
+	struct board_t board;
+
+	if (layout && !parse_board(layout, &board))
+	{
+		fprintf(stderr, "bad board %s\n", layout);
+		return 2;
+	}
+	else if (!layout)
+	{
+		for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+			board.rows[row] = BOARD_EMPTY_ROW;
+		board.rows[FIELD_HEIGHT - 1] = BOARD_FULL_ROW;
+	}
+
+	struct solver_t solver;
+	if (!solver_create(&solver, (size_t) memory << 20, threads))
+		return 1;
+
+	struct solver_stats_t stats = { 0, 0, 0, 0 };
+	int result = 0;
+
+	// answers hold for the moves the search makes - turns where the piece appears, slides along
+	// the top row and hard drops, with no gravity in between
+	if (queue)
+	{
+		int shapes_queue[SOLVER_MAX_QUEUE], spawns[SOLVER_MAX_QUEUE], length = 0;
+
+		// a digit after a piece is the rotation it appears in, 0 when left out
+		for (const char *c = queue; *c && length < SOLVER_MAX_QUEUE; c++)
+		{
+			const char *found = strchr(solver_shape_names, toupper((unsigned char) *c));
+			if (!found)
+			{
+				fprintf(stderr, "bad piece %c, use %s\n", *c, solver_shape_names);
+				solver_destroy(&solver);
+				return 2;
+			}
+
+			shapes_queue[length] = (int) (found - solver_shape_names);
+			spawns[length] = 0;
+			if (c[1] >= '0' && c[1] <= '3')
+				spawns[length] = (*++c - '0') % shapes[shapes_queue[length]].count;
+			length++;
+		}
+
+		// an empty well is already clear, there is nothing to search
+		BOOL fEmpty = TRUE;
+		for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+			fEmpty &= board.rows[row] == BOARD_EMPTY_ROW;
+
+		if (fEmpty)
+			printf("the board is empty, nothing to clear\n");
+		else if (solver_perfect_clear(&solver, &board, shapes_queue, spawns, length, &stats))
+		{
+			printf("clears with %d pieces:", solver.path_length);
+			for (int i = 0; i < solver.path_length; i++)
+				printf(" %c r%d x%d", solver_shape_names[shapes_queue[i]], solver.path[i].rotation, solver.path[i].x);
+			printf("\n");
+		}
+		else
+		{
+			printf("no clear with %s using turns at the spawn, slides and hard drops\n", queue);
+			result = 1;
+		}
+
+		if (!fEmpty)
+			print_solver_stats(&stats);
+	}
+
+	if (survive)
+	{
+		int pieces = solver_survival(&solver, &board, survive, &stats);
+		printf("survives %s%d pieces against any sequence of pieces and spawn rotations, using turns at the spawn, slides and hard drops\n",
+			(pieces == survive) ? "at least " : "", pieces);
+		print_solver_stats(&stats);
+	}
+
+	solver_destroy(&solver);
+	return result;
+}
+
+struct export_job_t
+{
+	struct dataset_t *dataset;
+	const struct tuner_config_t *config;
+	std::atomic<int> next_game;
+	std::mutex lock;
+	struct surface_cache_t cache;		// the workers' statistics, summed as they finish
+};
+
+// the bot plays seeds 0 to config->seeds - 1, each worker with its own game and producer
+void export_worker(struct export_job_t *job)
+{
+	struct game_t *game = new struct game_t;
+	struct sample_producer_t *producer = new struct sample_producer_t;
+	sample_producer_init(producer, job->dataset, 0);
+	struct surface_cache_t cache;
+	surface_cache_open(&cache);
+
+	for (int seed; (seed = job->next_game.fetch_add(1)) < job->config->seeds; )
+	{
+		struct piece_stream_t stream;
+		piece_stream_init(&stream, job->config->seed, (DWORD) seed, PIECE_BAG);
+
+		game_init(game, &stream);
+		game_apply(game, ACTION_START, 1);
+		producer->game_id = (DWORD) seed;
+		sample_spawn(producer, game);
+
+		for (int pieces = 0; game->fStart; pieces++)
+		{
+			struct board_t board;
+			struct placement_t placement;
+			struct piece_t piece;
+
+			board_from_field(game, &board);
+			if (pieces == job->config->piece_limit || !bot_choose_placement(&board, game->active_piece.shape, game->next_piece.shape, &default_weights, &cache, &placement))
+			{
+				sample_truncate(producer, game);
+				break;
+			}
+
+			int result = game_place(game, &placement, &piece);
+			sample_lock(producer, game, &piece, result);
+		}
+	}
+
+	sample_producer_close(producer);
+	delete producer;
+	delete game;
+
+	std::lock_guard<std::mutex> guard(job->lock);
+	surface_cache_add_stats(&job->cache, &cache);
+	surface_cache_destroy(&cache);
+}
+
+int run_export(const char *prefix, const struct tuner_config_t *config)
+{
+	struct dataset_t *dataset = new struct dataset_t;
+	if (!dataset_open(dataset, prefix, 0, config->threads))
+		return 1;
+
+	struct export_job_t job;
+	job.dataset = dataset;
+	job.config = config;
+	job.next_game = 0;
+	ZeroMemory(&job.cache, sizeof(job.cache));
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::thread *workers = new std::thread[config->threads];
+	for (int i = 0; i < config->threads; i++)
+		workers[i] = std::thread(export_worker, &job);
+	for (int i = 0; i < config->threads; i++)
+		workers[i].join();
+	delete [] workers;
+
+	BOOL result = dataset_close(dataset);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%d games, %llu records in %u shards, %.3f s, %.0f records/s\n", config->seeds, dataset->total, dataset->index_count,
+		seconds, seconds > 0 ? dataset->total / seconds : 0.0);
+	print_surface_stats(&job.cache);
+
+	delete dataset;
+	return result ? 0 : 1;
+}
+
+// two of these over loopback play a bot match - both print the same match hash when the
+// simulation is deterministic
+int run_versus(int player, int port, ULONGLONG seed, DWORD delay_ms, DWORD jitter_ms, DWORD ticks)
+{
+	struct versus_peer_t *peer = new struct versus_peer_t;
+	if (!versus_open(peer, player, port, seed, delay_ms, jitter_ms))
+	{
+		fprintf(stderr, "cannot bind port %d\n", port + player);
+		delete peer;
+		return 1;
+	}
+
+	// keep going until both sides hold every input, then a little longer so the other side
+	// sees our final acknowledgement
+	std::chrono::steady_clock::time_point linger;
+	BOOL fDone = FALSE;
+
+	for (;;)
+	{
+		versus_frame(peer, ticks);
+
+		if (!fDone && peer->match.tick == ticks && peer->confirmed >= ticks && peer->remote_ack >= ticks)
+		{
+			fDone = TRUE;
+			linger = std::chrono::steady_clock::now() + std::chrono::milliseconds(500 + 2 * (delay_ms + jitter_ms));
+		}
+
+		if (fDone && std::chrono::steady_clock::now() > linger)
+			break;
+
+		if (versus_clock(peer) > (ULONGLONG) (ticks * VERSUS_TICK_MS + 30000) * 1000)
+		{
+			fprintf(stderr, "player %d: timed out at tick %u, %u confirmed\n", player, peer->match.tick, peer->confirmed);
+			break;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	const struct match_t *match = &peer->match;
+	printf("player %d: %u ticks, hash %08X, scores %d %d, lines %d %d%s%s\n", player, match->tick, match_hash(match),
+		match->games[0].score, match->games[1].score, match->games[0].total_rows, match->games[1].total_rows,
+		match->games[0].fStart ? "" : ", player 0 topped out", match->games[1].fStart ? "" : ", player 1 topped out");
+	printf("player %d: round trip %.1f ms average %.1f ms max, %llu rollbacks of %.1f ticks average %u max, resimulation %.3f ms max, %llu stalls\n",
+		player, peer->round_trips ? peer->round_trip_total / peer->round_trips : 0.0, peer->round_trip_max, peer->rollbacks,
+		peer->rollbacks ? (double) peer->rollback_ticks / peer->rollbacks : 0.0, peer->max_depth, peer->resimulate_max, peer->stalls);
+	print_surface_stats(&peer->cache);
+
+	int result = fDone ? 0 : 1;
+	versus_close(peer);
+	delete peer;
+	return result;
+}
+
+// -batch n: random stacks in a batch of n boards, every placement of every shape tested
+// against all of them, checked against board_fits and timed against the scalar kernel
+int run_batch(int count, ULONGLONG seed)
+{
+	struct board_batch_t batch;
+	struct board_t *boards = new struct board_t[count];
+	board_batch_create(&batch, count);
+
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, seed, 0, PIECE_UNIFORM);
+
+	for (int b = 0; b < count; b++)
+	{
+		struct philox_words_t words;
+		philox_words_init(&words, &stream, b, DOMAIN_GARBAGE);
+
+		int height = (int) philox_below(&words, FIELD_HEIGHT - 4);
+		for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+			boards[b].rows[row] = (row >= FIELD_HEIGHT - 1 - height) ? (WORD) (BOARD_EMPTY_ROW | (philox_next(&words) & 0x07FE)) : BOARD_EMPTY_ROW;
+
+		boards[b].rows[FIELD_HEIGHT - 1] = BOARD_FULL_ROW;
+		board_batch_set(&batch, b, &boards[b]);
+	}
+
+	int blocks = (count + BATCH_BLOCK - 1) / BATCH_BLOCK;
+	struct placement_t *placements = new struct placement_t[4 * FIELD_WIDTH * FIELD_HEIGHT];
+	DWORD *results = new DWORD[(size_t) 4 * FIELD_WIDTH * FIELD_HEIGHT * blocks];
+	DWORD *expected = new DWORD[blocks];
+	ULONGLONG tests = 0, mismatches = 0;
+	double wide = 0, narrow = 0;
+
+	for (int shape = 0; shape < PIECE_COUNT; shape++)
+	{
+		int total = 0;
+		for (int rotation = 0; rotation < shapes[shape].count; rotation++)
+		{
+			int first, last;
+			shape_columns(shape, rotation, &first, &last);
+
+			for (int x = 1 - first; x <= FIELD_WIDTH - 2 - last; x++)
+			{
+				for (int y = 0; y < FIELD_HEIGHT; y++)
+				{
+					placements[total].rotation = rotation, placements[total].x = x, placements[total].y = y;
+					total++;
+				}
+			}
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		batch_fits_many(&batch, shape, placements, total, results);
+		auto middle = std::chrono::steady_clock::now();
+
+		for (int p = 0; p < total; p++)
+		{
+			const struct placement_t *placement = &placements[p];
+			batch_fits(&batch, shape, placement->rotation, placement->x, placement->y, expected, TRUE);
+
+			for (int b = 0; b < count; b++)
+			{
+				BOOL fFits = (results[p * blocks + b / BATCH_BLOCK] >> (b % BATCH_BLOCK)) & 1;
+				BOOL fScalar = (expected[b / BATCH_BLOCK] >> (b % BATCH_BLOCK)) & 1;
+
+				if (fFits != board_fits(&boards[b], shape, placement->rotation, placement->x, placement->y) || fFits != fScalar)
+					mismatches++;
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		// the scalar pass above also ran board_fits, so time the scalar kernel on its own
+		auto scalar = std::chrono::steady_clock::now();
+		for (int p = 0; p < total; p++)
+			batch_fits(&batch, shape, placements[p].rotation, placements[p].x, placements[p].y, results + p * blocks, TRUE);
+		end = std::chrono::steady_clock::now();
+
+		wide += std::chrono::duration<double>(middle - start).count();
+		narrow += std::chrono::duration<double>(end - scalar).count();
+		tests += (ULONGLONG) total * count;
+	}
+
+	printf("%d boards, %llu placement tests: %s %.1f M/s, scalar %.1f M/s, %llu mismatches\n", count, tests, BATCH_UNIT,
+		wide > 0 ? tests / wide / 1e6 : 0.0, narrow > 0 ? tests / narrow / 1e6 : 0.0, mismatches);
+
+	delete [] placements;
+	delete [] results;
+	delete [] expected;
+	delete [] boards;
+	board_batch_destroy(&batch);
+	return mismatches ? 1 : 0;
+}
+
+// -bench with -rollout: the same positions searched with 1, 2, 4 ... threads up to -threads,
+// for the rollout rate and its speedup over one thread. counts past the machine's cores
+// only share them, so the sweep prints the hardware thread count it ran on
+const int SWEEP_POSITIONS = 16;
+
+void bench_rollout(DWORD budget, int threads, ULONGLONG seed)
+{
+	struct board_t boards[SWEEP_POSITIONS];
+	int shapes[SWEEP_POSITIONS], next_shapes[SWEEP_POSITIONS];
+	int positions = 0;
+
+	// positions from a bot game of the -seed key, three pieces apart
+	struct game_t sweep;
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, seed, 0, PIECE_BAG);
+	game_init(&sweep, &stream);
+	game_apply(&sweep, ACTION_START, 1);
+
+	for (int i = 0; positions < SWEEP_POSITIONS && sweep.fStart; i++)
+	{
+		struct board_t board;
+		struct placement_t placement;
+
+		board_from_field(&sweep, &board);
+		if (i % 3 == 0)
+		{
+			boards[positions] = board;
+			shapes[positions] = sweep.active_piece.shape, next_shapes[positions] = sweep.next_piece.shape;
+			positions++;
+		}
+
+		if (!bot_choose_placement(&board, sweep.active_piece.shape, sweep.next_piece.shape, &default_weights, NULL, &placement))
+			break;
+		game_place(&sweep, &placement, NULL);
+	}
+
+	threads = (threads < 1) ? 1 : (threads > ROLLOUT_MAX_THREADS) ? ROLLOUT_MAX_THREADS : threads;
+
+	printf("rollout sweep: %d positions, %u ms each, hardware threads %u\n", positions, budget, std::thread::hardware_concurrency());
+
+	double base = 0;
+	for (int count = 1; count <= threads; count = (count < threads && count * 2 > threads) ? threads : count * 2)
+	{
+		struct rollout_pool_t *pool = new struct rollout_pool_t;
+		rollout_pool_create(pool, count);
+
+		struct rollout_stats_t stats = { 0, 0, 0, 0 };
+		for (int p = 0; p < positions; p++)
+		{
+			struct placement_t placement;
+			rollout_choose(pool, &boards[p], shapes[p], next_shapes[p], budget, seed + p, &placement, &stats);
+		}
+
+		rollout_pool_destroy(pool);
+		delete pool;
+
+		double rate = stats.seconds > 0 ? stats.rollouts / stats.seconds : 0.0;
+		if (count == 1)
+			base = rate;
+
+		printf("%2d threads: %llu rollouts, %.0f rollouts/s, %.2fx\n", count, stats.rollouts, rate, base > 0 ? rate / base : 0.0);
+
+		if (count == threads)
+			break;
+	}
+}
+
+// -check: regression checks for paths that games rarely or never take, one line each, and
+// the exit code is the number that failed
+BOOL check_surface_cache(void)
+{
+	// two staircases of four row steps, 16 rows from the lowest to the highest column
+	const int heights[FIELD_WIDTH - 2] = { 0, 4, 8, 12, 16, 0, 4, 8, 12, 16 };
+	struct board_t board;
+
+	for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+		board.rows[row] = BOARD_EMPTY_ROW;
+	board.rows[FIELD_HEIGHT - 1] = BOARD_FULL_ROW;
+
+	for (int col = 1; col < FIELD_WIDTH - 1; col++)
+	{
+		for (int h = 0; h < heights[col - 1]; h++)
+			board.rows[FIELD_HEIGHT - 2 - h] |= 1 << col;
+	}
+
+	struct surface_cache_t cache;
+	if (!surface_cache_open(&cache))
+		return FALSE;
+
+	// every piece pair twice, a miss and then a hit, against the evaluator itself
+	int differ = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int shape = 0; shape < PIECE_COUNT; shape++)
+		{
+			for (int next_shape = 0; next_shape < PIECE_COUNT; next_shape++)
+			{
+				struct placement_t cached, exact;
+				BOOL fCached = bot_choose_placement(&board, shape, next_shape, &default_weights, &cache, &cached);
+				BOOL fExact = evaluate_placements(&board, shape, next_shape, &default_weights, &exact);
+
+				if (fCached != fExact || (fExact && (cached.rotation != exact.rotation || cached.x != exact.x ||
+					cached.y != exact.y || cached.value != exact.value)))
+					differ++;
+			}
+		}
+	}
+
+	BOOL result = !differ && cache.hits == PIECE_COUNT * PIECE_COUNT && cache.misses == PIECE_COUNT * PIECE_COUNT;
+	printf("surface cache: stepped stack, %llu hits %llu misses, %d answers differ from the evaluator - %s\n",
+		cache.hits, cache.misses, differ, result ? "ok" : "FAILED");
+
+	surface_cache_destroy(&cache);
+	return result;
+}
+
+// pixels worked out by hand for brick 16, where the gaps and bevels are one pixel wide - the
+// golden image only holds what this renderer drew when it was made, these hold what it should
+BOOL check_raster(void)
+{
+	struct frame_t frame;
+	memset(frame.field, BLACK, sizeof(frame.field));
+	frame.level = frame.total_rows = frame.score = 0;
+
+	struct raster_t raster;
+	if (!raster_create(&raster, 16, 16))
+		return FALSE;
+
+	struct { int x, y; DWORD pixel; } expected[] =
+	{
+		{ 0, 416, 0xFF000000 }, { 1, 417, 0xFFFF0000 }, { 14, 430, 0xFFFF0000 }, { 15, 431, 0xFF000000 },	// red at row 26 col 1
+		{ 144, 417, 0xFF000000 }, { 145, 417, 0xFF0000FF }, { 158, 430, 0xFF0000FF }, { 159, 417, 0xFF000000 },	// blue at row 26 col 10
+		{ 64, 321, 0xFF000000 }, { 65, 321, 0xFF303030 }, { 78, 334, 0xFF303030 },						// ghost at row 20 col 5
+		{ 177, 33, 0xFFFFFF00 }, { 176, 33, 0xFF000000 },												// yellow in the next box
+		{ 160, 100, 0xFFFFFFFF }, { 161, 100, 0xFF808080 }, { 165, 100, 0xFFC0C0C0 },					// panel bevel, left
+		{ 270, 100, 0xFFFFFFFF }, { 271, 100, 0xFF404040 }, { 200, 0, 0xFFFFFFFF }, { 200, 431, 0xFF404040 },	// right, top, bottom
+	};
+
+	// once drawn whole and once over an empty well, the incremental path
+	int wrong = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass)
+		{
+			raster.fValid = FALSE;
+			raster_render(&raster, &frame);
+		}
+
+		frame.field[26][1] = RED, frame.field[26][10] = BLUE, frame.field[20][5] = GHOST, frame.field[2][12] = YELLOW;
+		raster_render(&raster, &frame);
+
+		for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+		{
+			if (raster.frame.pixels[(size_t) expected[i].y * raster.frame.stride + expected[i].x] != expected[i].pixel)
+				wrong++;
+		}
+
+		memset(frame.field, BLACK, sizeof(frame.field));
+	}
+
+	printf("raster: %d of %d hand checked pixels wrong - %s\n", wrong, (int) (2 * sizeof(expected) / sizeof(expected[0])), wrong ? "FAILED" : "ok");
+
+	raster_destroy(&raster);
+	return !wrong;
+}
+
+// a ring filled by a bot game through log_game_event, packed as the writer packs it and
+// unpacked again, then the same block cut short, which must be refused
+BOOL check_telemetry(void)
+{
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, 1, 0, PIECE_BAG);
+
+	struct game_t *checked = new struct game_t;
+	game_init(checked, &stream);
+	checked->fTelemetry = TRUE;
+
+	// running with no writer, so the events stay in this thread's ring
+	telemetry.running = true;
+	game_apply(checked, ACTION_START, 1);
+
+	for (int i = 0; i < 300 && checked->fStart; i++)
+	{
+		struct board_t board;
+		struct placement_t placement;
+
+		board_from_field(checked, &board);
+		if (!bot_choose_placement(&board, checked->active_piece.shape, checked->next_piece.shape, &default_weights, NULL, &placement))
+			break;
+		game_place(checked, &placement, NULL);
+	}
+
+	telemetry.running = false;
+	delete checked;
+
+	struct event_ring_t *ring = event_ring;
+	if (!ring)
+		return FALSE;
+
+	DWORD tail = ring->tail.load(), count = ring->head.load() - tail;
+	struct event_t *events = new struct event_t[count], *unpacked = new struct event_t[count];
+	BYTE *packed = new BYTE[count * sizeof(struct event_t) * 2];
+
+	for (DWORD i = 0; i < count; i++)
+		events[i] = ring->events[(tail + i) & (EVENT_RING_SIZE - 1)];
+	ring->tail.store(tail + count);
+
+	DWORD size = pack_events(events, count, packed);
+	BOOL fRound = count > 0 && unpack_events(packed, size, unpacked, count) && !memcmp(events, unpacked, count * sizeof(struct event_t));
+	BOOL fShort = !unpack_events(packed, size - 1, unpacked, count);
+
+	BOOL result = fRound && fShort && !ring->dropped.load();
+	printf("telemetry: %u events in %u bytes, round trip %s, cut block %s - %s\n", count, size,
+		fRound ? "equal" : "differs", fShort ? "refused" : "accepted", result ? "ok" : "FAILED");
+
+	delete [] packed;
+	delete [] unpacked;
+	delete [] events;
+
+	telemetry_free();
+	return result;
+}
+
+// an archive left without its footer, the way a crash leaves it - a bot game recorded action
+// by action, the file closed behind the writer's back and cut in the middle of a record past
+// the third keyframe. replay_map then has to rebuild the index with replay_scan, and a seek to
+// the last tick it found must give the game as it stood after the last whole record
+BOOL check_replay_recovery(void)
+{
+	char path[MAX_PATH];
+	const char *folder = getenv("TMPDIR");
+	sprintf_s(path, sizeof(path), "%s/tetris-check-%d.trp", folder ? folder : "/tmp", (int) getpid());
+
+	struct replay_archive_t archive;
+	if (!replay_create(&archive, path))
+		return FALSE;
+
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, 1, 0, PIECE_BAG);
+
+	struct game_t *live = new struct game_t, *expected = new struct game_t, *found = new struct game_t;
+	game_init(live, &stream);
+	game_apply(live, ACTION_START, 0);
+	replay_begin_game(&archive, live);
+
+	ULONGLONG planned = 0, cut = 0;
+	BYTE plan[16];
+	int length = 0, position = 0, after = 0;
+	DWORD time = 0;
+
+	// the same input timing as tuner_play, every action recorded before it is applied
+	while (live->fStart && (!cut || after++ < 50))
+	{
+		if (live->piece_index != planned)
+		{
+			struct board_t board;
+			struct placement_t placement;
+
+			board_from_field(live, &board);
+			if (!bot_choose_placement(&board, live->active_piece.shape, live->next_piece.shape, &default_weights, NULL, &placement))
+				break;
+
+			planned = live->piece_index;
+			length = placement_inputs(live, &placement, plan), position = 0;
+		}
+
+		DWORD due = game_gravity_due(live), tick;
+		enum action_type action;
+
+		if (position < length && (int) (due - time) > 0)
+			action = (enum action_type) plan[position++], tick = time, time += TUNER_INPUT_MS;
+		else
+			action = ACTION_GRAVITY, tick = ((int) (due - live->tick) > 0) ? due : live->tick;
+
+		replay_record(&archive, live, action, tick);
+		game_apply(live, action, tick);
+
+		// one byte into the record after this one
+		if (!cut && tick >= 3 * REPLAY_KEYFRAME_TICKS + 1234)
+		{
+			*expected = *live;
+			cut = archive.offset + 1;
+		}
+	}
+
+	// no replay_close, so no index and no footer
+	BOOL result = cut && !archive.fFailed && fclose(archive.file) == 0 && truncate(path, (off_t) cut) == 0;
+	delete [] archive.games;
+	delete [] archive.keyframes;
+
+	struct replay_reader_t reader;
+	DWORD keyframes = 0;
+
+	if (result && replay_map(&reader, path))
+	{
+		keyframes = reader.game_count ? reader.games[0].keyframe_count : 0;
+		result = reader.game_count == 1 && keyframes > 3 && reader.games[0].last_tick == expected->tick &&
+			replay_seek(&reader, 0, reader.games[0].last_tick, found) &&
+			!memcmp(found->field, expected->field, sizeof(found->field)) && found->score == expected->score &&
+			found->total_rows == expected->total_rows && found->piece_index == expected->piece_index &&
+			!memcmp(&found->active_piece, &expected->active_piece, sizeof(struct piece_t)) && found->tick == expected->tick;
+
+		replay_unmap(&reader);
+	}
+	else
+		result = FALSE;
+
+	printf("replay recovery: cut at byte %llu, %u keyframes rebuilt, seek to tick %u %s - %s\n", cut, keyframes,
+		expected->tick, result ? "matches the live game" : "differs", result ? "ok" : "FAILED");
+
+	remove(path);
+	delete found;
+	delete expected;
+	delete live;
+	return result;
+}
+
+int run_checks(void)
+{
+	int failed = 0;
+
+	failed += !check_surface_cache();
+	failed += !check_raster();
+	failed += !check_telemetry();
+	failed += !check_replay_recovery();
+
+	printf("%d checks failed\n", failed);
+	return failed;
+}
+
+// -plugin file: the plugin plays -pieces pieces of a seeded game, -budget microseconds a call
+int run_plugin(const char *path, const char *options, int pieces, DWORD budget_us, ULONGLONG seed)
+{
+	struct bot_plugin_t plugin;
+	if (!bot_plugin_load(&plugin, path, options))
+	{
+		fprintf(stderr, "cannot load %s\n", path);
+		return 1;
+	}
+
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, seed, 0, PIECE_BAG);
+
+	struct game_t *game = new struct game_t;
+	game_init(game, &stream);
+	game_apply(game, ACTION_START, 0);
+
+	auto start = std::chrono::steady_clock::now();
+	int played = 0;
+	while (played < pieces && game->fStart)
+	{
+		bot_plugin_play(&plugin, game, budget_us);
+		played++;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// percentiles to the power of two bucket they fall in
+	ULONGLONG p50 = 0, p99 = 0, seen = 0;
+	for (int bucket = 0; bucket < 32; bucket++)
+	{
+		seen += plugin.latency[bucket];
+		if (!p50 && seen * 2 >= plugin.calls)
+			p50 = 1ULL << bucket;
+		if (!p99 && seen * 100 >= plugin.calls * 99)
+			p99 = 1ULL << bucket;
+	}
+
+	printf("%s: %d pieces in %.3f s, %.0f pieces/s, level %d, lines %d, score %d%s\n", plugin.api->name ? plugin.api->name : path,
+		played, seconds, seconds > 0 ? played / seconds : 0.0, game->level + 1, game->total_rows, game->score, game->fStart ? "" : ", topped out");
+	printf("%llu calls: %.1f us average, p50 < %llu us, p99 < %llu us, %.1f us max, %llu over %u us, %llu without a move\n", plugin.calls,
+		plugin.calls ? plugin.total_us / plugin.calls : 0.0, p50, p99, plugin.max_us, plugin.overruns, budget_us, plugin.failures);
+
+	delete game;
+	bot_plugin_unload(&plugin);
+	return 0;
+}
+
+// terminal front end for play over ssh - the window's picture in character cells, two to a
+// brick. the screen last sent is kept, so a frame only writes the cells that changed, with a
+// cursor move where the changed cells are not contiguous and a color change where the colors
+// differ, all gathered into a single write. a piece moving one column is a few dozen bytes
+const int TERM_WIDTH = 2 * (FIELD_WIDTH + INFO_WIDTH);
+const int TERM_BUFFER = 65536;
+const DWORD TERM_ESCAPE_MS = 50;	// an escape with nothing after it for this long is the escape key
+
+struct term_cell_t
+{
+	char text;
+	BYTE fg, bg;		// xterm 256 color indices
+};
+
+struct term_t
+{
+	struct term_cell_t screen[FIELD_HEIGHT][TERM_WIDTH];
+	int row, col;		// where the terminal's cursor is, -1 when unknown
+	int fg, bg;
+	struct termios saved;
+	char *buffer;
+	int length;
+	ULONGLONG frames, bytes;
+
+	// the start of an escape sequence the last read cut off
+	char pending[2];
+	int pending_length;
+	DWORD pending_time;
+};
+
+// nearest entry of the 6x6x6 color cube
+inline BYTE term_color(COLORREF color)
+{
+	return (BYTE) (16 + 36 * ((GetRValue(color) * 5 + 127) / 255) + 6 * ((GetGValue(color) * 5 + 127) / 255) + (GetBValue(color) * 5 + 127) / 255);
+}
+
+const BYTE TERM_BLACK = 16, TERM_WHITE = 231;
+
+inline void term_append(struct term_t *term, const char *text, int length)
+{
+	if (term->length + length <= TERM_BUFFER)
+		memcpy(term->buffer + term->length, text, length), term->length += length;
+}
+
+void term_flush(struct term_t *term)
+{
+	for (int done = 0; done < term->length; )
+	{
+		ssize_t written = write(STDOUT_FILENO, term->buffer + done, term->length - done);
+		if (written <= 0)
+			break;
+		done += (int) written;
+	}
+
+	term->bytes += term->length;
+	term->length = 0;
+}
+
+BOOL term_open(struct term_t *term)
+{
+	ZeroMemory(term, sizeof(struct term_t));
+
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &term->saved))
+		return FALSE;
+
+	// raw keys without echo, reads that return at once and ctrl-c as a key, so the terminal is
+	// always restored on the way out
+	struct termios raw = term->saved;
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+	raw.c_cc[VMIN] = 0, raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+	term->buffer = new char[TERM_BUFFER];
+	term->row = term->col = -1;
+	term->fg = term->bg = -1;
+
+	// nothing on screen matches these, so the first frame draws everything
+	memset(term->screen, 0xFF, sizeof(term->screen));
+
+	const char start[] = "\x1b[?25l\x1b[2J";
+	term_append(term, start, sizeof(start) - 1);
+	term_flush(term);
+	return TRUE;
+}
+
+void term_close(struct term_t *term)
+{
+	char text[32];
+	int length = sprintf_s(text, sizeof(text), "\x1b[0m\x1b[%d;1H\x1b[?25h", FIELD_HEIGHT + 1);
+	term_append(term, text, length);
+	term_flush(term);
+
+	tcsetattr(STDIN_FILENO, TCSANOW, &term->saved);
+	delete [] term->buffer;
+}
+
+inline void term_text(struct term_cell_t row[TERM_WIDTH], int col, const char *text, BYTE fg, BYTE bg)
+{
+	for (; *text && col < TERM_WIDTH; text++, col++)
+		row[col].text = *text, row[col].fg = fg, row[col].bg = bg;
+}
+
+// the frame as cells - bricks are two spaces on the brick's color, the labels and counters
+// are written over the panel like raster_background and raster_counter place them
+void term_compose(const struct frame_t *frame, struct term_cell_t screen[FIELD_HEIGHT][TERM_WIDTH])
+{
+	for (int row = 0; row < FIELD_HEIGHT; row++)
+	{
+		for (int col = 0; col < FIELD_WIDTH + INFO_WIDTH; col++)
+		{
+			BYTE bg = term_color(color_value[frame->field[row][col]]);
+			screen[row][2 * col].text = screen[row][2 * col + 1].text = ' ';
+			screen[row][2 * col].fg = screen[row][2 * col + 1].fg = TERM_BLACK;
+			screen[row][2 * col].bg = screen[row][2 * col + 1].bg = bg;
+		}
+	}
+
+	BYTE panel = term_color(color_value[GRAY]);
+	int values[4] = { 0, frame->level, frame->total_rows, frame->score };
+
+	for (int box = 0; box < 4; box++)
+	{
+		int left = 2 * FIELD_WIDTH, width = 2 * 5;
+		int label = (int) strlen(PANEL_LABEL[box]);
+		term_text(screen[PANEL_BOX_TOP[box] - 1], left + (width - label) / 2, PANEL_LABEL[box], TERM_BLACK, panel);
+
+		if (box)
+		{
+			for (int row = PANEL_BOX_TOP[box]; row < PANEL_BOX_BOTTOM[box]; row++)
+				term_text(screen[row], left, "          ", TERM_WHITE, TERM_BLACK);
+
+			char text[16];
+			sprintf_s(text, sizeof(text), "%06d", values[box]);
+			term_text(screen[(PANEL_BOX_TOP[box] + PANEL_BOX_BOTTOM[box] - 1) / 2], left + (width - 6) / 2, text, TERM_WHITE, TERM_BLACK);
+		}
+	}
+
+	term_text(screen[21], 2 * FIELD_WIDTH - 2, " Space start", TERM_BLACK, panel);
+	term_text(screen[22], 2 * FIELD_WIDTH - 2, " Arrows move", TERM_BLACK, panel);
+	term_text(screen[23], 2 * FIELD_WIDTH - 2, " Q - Exit", TERM_BLACK, panel);
+}
+
+inline BOOL term_same(const struct term_cell_t *a, const struct term_cell_t *b)
+{
+	return a->text == b->text && a->fg == b->fg && a->bg == b->bg;
+}
+
+// the shortest way to the cell - an absolute position, steps up or down then left or right,
+// or on the same row writing a short gap again when it already shows the current color
+void term_move(struct term_t *term, const struct term_cell_t next[FIELD_HEIGHT][TERM_WIDTH], int row, int col)
+{
+	if (row == term->row && col == term->col)
+		return;
+
+	char best[32], step[32];
+	int length = sprintf_s(best, sizeof(best), "\x1b[%d;%dH", row + 1, col + 1);
+
+	if (term->row >= 0)
+	{
+		int rows = row - term->row, cols = col - term->col, used = 0;
+
+		if (rows == 1 || rows == -1)
+			used += sprintf_s(step, sizeof(step), "\x1b[%c", (rows < 0) ? 'A' : 'B');
+		else if (rows)
+			used += sprintf_s(step, sizeof(step), "\x1b[%d%c", abs(rows), (rows < 0) ? 'A' : 'B');
+
+		if (cols < 0 && cols >= -3)
+			for (; cols; cols++)
+				step[used++] = '\b';
+		else if (cols < 0)
+			used += sprintf_s(step + used, sizeof(step) - used, "\x1b[%dD", -cols);
+		else if (cols > 0)
+		{
+			BOOL fFill = !rows && cols <= 3;
+			for (int skip = term->col; skip < col && fFill; skip++)
+				fFill = term_same(&next[row][skip], &term->screen[row][skip]) && next[row][skip].fg == term->fg && next[row][skip].bg == term->bg;
+
+			if (fFill)
+				for (int skip = term->col; skip < col; skip++)
+					step[used++] = next[row][skip].text;
+			else
+				used += sprintf_s(step + used, sizeof(step) - used, "\x1b[%dC", cols);
+		}
+
+		if (used < length)
+			memcpy(best, step, used), length = used;
+	}
+
+	term_append(term, best, length);
+	term->row = row, term->col = col;
+}
+
+// writes the cells that differ from the last frame and returns the bytes sent. they go out
+// one color at a time, starting with the color already set, so a frame costs one color
+// change per color it uses rather than one per brick
+int term_render(struct term_t *term, const struct frame_t *frame)
+{
+	struct term_cell_t next[FIELD_HEIGHT][TERM_WIDTH];
+	term_compose(frame, next);
+
+	char text[32];
+	int fg = term->fg, bg = term->bg;
+
+	for (;;)
+	{
+		BOOL fPending = FALSE, fCurrent = FALSE;
+
+		for (int row = 0; row < FIELD_HEIGHT && !fCurrent; row++)
+		{
+			for (int col = 0; col < TERM_WIDTH; col++)
+			{
+				const struct term_cell_t *cell = &next[row][col];
+				if (term_same(cell, &term->screen[row][col]))
+					continue;
+
+				if (cell->fg == term->fg && cell->bg == term->bg)
+				{
+					fCurrent = TRUE;
+					break;
+				}
+
+				if (!fPending)
+					fg = cell->fg, bg = cell->bg, fPending = TRUE;
+			}
+		}
+
+		if (fCurrent)
+			fg = term->fg, bg = term->bg;
+		else if (!fPending)
+			break;
+
+		for (int row = 0; row < FIELD_HEIGHT; row++)
+		{
+			for (int col = 0; col < TERM_WIDTH; col++)
+			{
+				const struct term_cell_t *cell = &next[row][col];
+				if (term_same(cell, &term->screen[row][col]) || cell->fg != fg || cell->bg != bg)
+					continue;
+
+				term_move(term, next, row, col);
+
+				if (fg != term->fg && bg != term->bg)
+					term_append(term, text, sprintf_s(text, sizeof(text), "\x1b[38;5;%d;48;5;%dm", fg, bg));
+				else if (fg != term->fg)
+					term_append(term, text, sprintf_s(text, sizeof(text), "\x1b[38;5;%dm", fg));
+				else if (bg != term->bg)
+					term_append(term, text, sprintf_s(text, sizeof(text), "\x1b[48;5;%dm", bg));
+
+				term_append(term, &cell->text, 1);
+				term->screen[row][col] = *cell;
+				term->row = row, term->col = col + 1;
+				term->fg = fg, term->bg = bg;
+			}
+		}
+	}
+
+	int length = term->length;
+	term_flush(term);
+	term->frames++;
+	return length;
+}
+
+// the keys waiting on stdin as actions, FALSE once the player asks to leave
+// arrows arrive as escape [ A to D and may be split across reads, so an unfinished sequence
+// is carried to the next call. an escape followed by anything else, or by nothing for
+// TERM_ESCAPE_MS, is the escape key
+BOOL term_input(struct term_t *term, enum action_type *actions, int *count, int capacity)
+{
+	char keys[64];
+	int length = term->pending_length;
+
+	memcpy(keys, term->pending, length);
+	ssize_t got = read(STDIN_FILENO, keys + length, sizeof(keys) - length);
+	if (got > 0)
+		length += (int) got;
+
+	*count = 0;
+	term->pending_length = 0;
+
+	for (int i = 0; i < length && *count < capacity; i++)
+	{
+		if (keys[i] == 0x1B && (i + 1 == length || (keys[i + 1] == '[' && i + 2 == length)))
+		{
+			if (got <= 0 && timeGetTime() - term->pending_time >= TERM_ESCAPE_MS)
+				return FALSE;
+
+			if (got > 0)
+				term->pending_time = timeGetTime();
+
+			term->pending_length = length - i;
+			memcpy(term->pending, keys + i, term->pending_length);
+			break;
+		}
+
+		if (keys[i] == 0x1B && keys[i + 1] == '[')
+		{
+			switch (keys[i + 2])
+			{
+			case 'A': actions[(*count)++] = ACTION_ROTATE; break;
+			case 'B': actions[(*count)++] = ACTION_DROP; break;
+			case 'C': actions[(*count)++] = ACTION_RIGHT; break;
+			case 'D': actions[(*count)++] = ACTION_LEFT; break;
+			default: break;
+			}
+
+			i += 2;
+		}
+		else if (keys[i] == 0x1B || keys[i] == 'q' || keys[i] == 3)
+			return FALSE;
+		else if (keys[i] == ' ')
+			actions[(*count)++] = ACTION_START;
+	}
+
+	return TRUE;
+}
+
+// -terminal: the player's game in the terminal, recorded to tetris.trp like the window's
+int run_terminal(void)
+{
+	struct term_t *term = new struct term_t;
+	if (!term_open(term))
+	{
+		fprintf(stderr, "-terminal needs a terminal on stdin\n");
+		delete term;
+		return 1;
+	}
+
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, (ULONGLONG) time(NULL) ^ timeGetTime(), 0, PIECE_UNIFORM);
+	game_init(&game, &stream);
+	replay_create(&replay, "tetris.trp");
+
+	struct frame_t frame;
+	fDirty = TRUE;
+
+	for (;;)
+	{
+		enum action_type actions[16];
+		int count;
+
+		if (!term_input(term, actions, &count, 16))
+			break;
+
+		for (int i = 0; i < count; i++)
+		{
+			if (game.fStart || actions[i] == ACTION_START)
+				play_action(actions[i]);
+		}
+
+		if (game.fStart && (int) (timeGetTime() - game_start_time - game_gravity_due(&game)) >= 0)
+			play_action(ACTION_GRAVITY);
+
+		if (fDirty)
+		{
+			fDirty = FALSE;
+			frame_fill(&frame, &game);
+			term_render(term, &frame);
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	BOOL fSaved = replay_close(&replay, &game);
+	term_close(term);
+
+	if (!fSaved)
+		fprintf(stderr, "cannot write tetris.trp\n");
+
+	printf("score %d, %llu frames, %.1f bytes a frame\n", game.score, term->frames, term->frames ? (double) term->bytes / term->frames : 0.0);
+	delete term;
+	return 0;
+}
+
+// -analyze depth: every distinct placement of the seeded bag's pieces, depth pieces deep,
+// from -board or an empty well, then rebuilt boards checked against replays from the root
+int run_analysis(const char *layout, int depth, ULONGLONG seed)
+{
+	struct board_t board;
+
+	if (layout && !parse_board(layout, &board))
+	{
+		fprintf(stderr, "bad board %s\n", layout);
+		return 2;
+	}
+	else if (!layout)
+	{
+		for (int row = 0; row < FIELD_HEIGHT - 1; row++)
+			board.rows[row] = BOARD_EMPTY_ROW;
+		board.rows[FIELD_HEIGHT - 1] = BOARD_FULL_ROW;
+	}
+
+	struct analysis_tree_t tree;
+	if (!analysis_create(&tree, &board, 4096))
+		return 1;
+
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, seed, 0, PIECE_BAG);
+
+	// the children of one level are added in order, so each level is a range of ids
+	auto start = std::chrono::steady_clock::now();
+	DWORD first = 0, last = 1;
+
+	for (int level = 0; level < depth && depth < 255; level++)
+	{
+		struct piece_t piece;
+		piece_at(&stream, level, &piece);
+		printf("%c", solver_shape_names[piece.shape]);
+
+		for (DWORD id = first; id < last; id++)
+			analysis_expand(&tree, id, piece.shape);
+
+		first = last, last = tree.node_count;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// sample nodes rebuilt through the cache against all their pieces locked from the root
+	struct piece_stream_t sampler;
+	piece_stream_init(&sampler, seed, 1, PIECE_UNIFORM);
+	int mismatches = 0;
+
+	for (int i = 0; i < 10000; i++)
+	{
+		struct philox_words_t words;
+		philox_words_init(&words, &sampler, i, DOMAIN_UNIFORM);
+		DWORD node = philox_below(&words, tree.node_count);
+
+		DWORD path[256];
+		int length = 0;
+		for (DWORD id = node; id; id = tree.nodes[id].parent)
+			path[length++] = id;
+
+		struct board_t replayed = board, rebuilt;
+		while (length-- > 0)
+		{
+			const struct analysis_node_t *step = &tree.nodes[path[length]];
+			board_lock(&replayed, step->shape, step->rotation, step->x, step->y);
+		}
+
+		analysis_board(&tree, node, &rebuilt);
+		if (memcmp(&replayed, &rebuilt, sizeof(struct board_t)))
+			mismatches++;
+	}
+
+	DWORD best = analysis_best_leaf(&tree, 0);
+	size_t bytes = analysis_bytes(&tree);
+
+	printf(": %u positions in %.3f s, %u boards kept for %llu keyframes, %.1f MB, %.1f bytes a position\n", tree.node_count, seconds,
+		tree.board_count, tree.keyframes, bytes / 1048576.0, (double) bytes / tree.node_count);
+	printf("best line %.2f with %d rows cleared, cache %llu hits %llu misses %llu locks replayed, %d mismatches\n",
+		tree.nodes[best].value, tree.nodes[best].total_lines, tree.hits, tree.misses, tree.replayed, mismatches);
+
+	analysis_destroy(&tree);
+	return mismatches ? 1 : 0;
+}
+
+int run_tuner(const struct tuner_config_t *config, int generations, const char *checkpoint)
+{
+	struct tuner_t tuner;
+	if (config->population < 2 || config->seeds < 1 || !tuner_create(&tuner, config))
+		return 2;
+
+	int loaded = checkpoint ? tuner_load(&tuner, checkpoint) : 0;
+	if (loaded < 0)
+	{
+		fprintf(stderr, "%s is not a checkpoint of a run with these settings\n", checkpoint);
+		tuner_destroy(&tuner);
+		return 2;
+	}
+
+	if (loaded)
+		printf("resuming %s at generation %d\n", checkpoint, tuner.state.generation);
+
+	for (int target = tuner.state.generation + generations; tuner.state.generation < target; )
+	{
+		auto start = std::chrono::steady_clock::now();
+		int played = tuner_generation(&tuner);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		tuner.state.seconds += seconds;
+
+		const struct tuner_state_t *state = &tuner.state;
+		printf("generation %d: mean %.0f, best %.0f, %.1f games/s, weights %.4f %.4f %.4f %.4f\n", state->generation,
+			tuner.fitness[0], state->best_fitness, seconds > 0 ? played / seconds : 0.0, state->best[0], state->best[1], state->best[2], state->best[3]);
+		fflush(stdout);
+
+		if (checkpoint && !tuner_save(&tuner, checkpoint))
+			fprintf(stderr, "cannot write %s\n", checkpoint);
+	}
+
+	printf("%llu games in %.1f s\n", tuner.state.games, tuner.state.seconds);
+
+	struct surface_cache_t total;
+	ZeroMemory(&total, sizeof(total));
+	for (int i = 0; i < tuner.config.threads; i++)
+		surface_cache_add_stats(&total, &tuner.caches[i]);
+	print_surface_stats(&total);
+
+	tuner_destroy(&tuner);
+	return 0;
+}
+
+// headless build - a bot plays a seeded game and the software renderer draws it, for golden
+// image checks and render timing where there is no window. golden.bmp next to this file is
+// the picture of the default game, so 'tetris -golden golden.bmp' with no other options matches
+int main(int argc, char *argv[])
+{
+	int brick = BRICK_WIDTH, pieces = 200;
+	ULONGLONG seed = 1;
+	const char *capture = NULL, *golden = NULL, *layout = NULL, *queue = NULL;
+	int survive = 0, threads = (int) std::thread::hardware_concurrency(), memory = 64;
+	int tune = 0, population = 24, seeds = 8;
+	DWORD rollout = 0;
+	int versus = -1, port = 27400, delay = 0, jitter = 0, ticks = 3000;
+	const char *checkpoint = NULL, *export_prefix = NULL;
+	BOOL fBench = FALSE;
+	int batch = 0;
+	const char *plugin = NULL, *plugin_options = NULL;
+	DWORD budget = 10000;
+	BOOL fTerminal = FALSE;
+	int analyze = 0;
+	const char *save_surface = NULL;
+	BOOL fCheck = FALSE;
+
+	for (int i = 1; i < argc; i++)
+	{
+		BOOL fValue = i + 1 < argc;
+
+		if (!strcmp(argv[i], "-brick") && fValue)
+			brick = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-seed") && fValue)
+			seed = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-pieces") && fValue)
+			pieces = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-capture") && fValue)
+			capture = argv[++i];
+		else if (!strcmp(argv[i], "-golden") && fValue)
+			golden = argv[++i];
+		else if (!strcmp(argv[i], "-bench"))
+			fBench = TRUE;
+		else if (!strcmp(argv[i], "-board") && fValue)
+			layout = argv[++i];
+		else if (!strcmp(argv[i], "-clear") && fValue)
+			queue = argv[++i];
+		else if (!strcmp(argv[i], "-survive") && fValue)
+			survive = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-threads") && fValue)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-memory") && fValue)
+			memory = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-tune") && fValue)
+			tune = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-population") && fValue)
+			population = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-games") && fValue)
+			seeds = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-checkpoint") && fValue)
+			checkpoint = argv[++i];
+		else if (!strcmp(argv[i], "-export") && fValue)
+			export_prefix = argv[++i];
+		else if (!strcmp(argv[i], "-rollout") && fValue)
+			rollout = (DWORD) atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-versus") && fValue)
+			versus = atoi(argv[++i]) & 1;
+		else if (!strcmp(argv[i], "-port") && fValue)
+			port = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-delay") && fValue)
+			delay = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-jitter") && fValue)
+			jitter = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-ticks") && fValue)
+			ticks = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-batch") && fValue)
+			batch = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-plugin") && fValue)
+			plugin = argv[++i];
+		else if (!strcmp(argv[i], "-options") && fValue)
+			plugin_options = argv[++i];
+		else if (!strcmp(argv[i], "-budget") && fValue)
+			budget = (DWORD) atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-terminal"))
+			fTerminal = TRUE;
+		else if (!strcmp(argv[i], "-analyze") && fValue)
+			analyze = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-surface") && fValue)
+			surface_table_path = argv[++i];
+		else if (!strcmp(argv[i], "-save-surface") && fValue)
+			save_surface = argv[++i];
+		else if (!strcmp(argv[i], "-check"))
+			fCheck = TRUE;
+		else
+		{
+			fprintf(stderr, "usage: %s [-brick n] [-seed n] [-pieces n] [-capture file.bmp] [-golden file.bmp] [-bench]\n"
+				"\t[-board rows] [-clear OITLJZS[0-3]...] [-survive depth] [-threads n] [-memory mb]\n"
+				"\t[-tune generations] [-population n] [-games n] [-checkpoint file] [-export prefix]\n"
+				"\t[-rollout ms] [-versus 0|1] [-port n] [-delay ms] [-jitter ms] [-ticks n]\n"
+				"\t[-batch boards] [-plugin file] [-options text] [-budget us] [-terminal] [-analyze depth]\n"
+				"\t[-surface file] [-save-surface file] [-check]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (brick < 4)
+		brick = 4;
+
+	if (fCheck)
+		return run_checks();
+
+	if (batch > 0)
+		return run_batch(batch, seed);
+
+	if (plugin)
+		return run_plugin(plugin, plugin_options, pieces, budget, seed);
+
+	if (fTerminal)
+		return run_terminal();
+
+	if (analyze > 0)
+		return run_analysis(layout, analyze, seed);
+
+	if (tune)
+	{
+		// -pieces caps each tuning game, the seeds are 0 to games - 1 of the -seed key
+		struct tuner_config_t config = { population, 0, seeds, pieces, threads, seed };
+		return run_tuner(&config, tune, checkpoint);
+	}
+
+	// player 0 listens on port and player 1 on port + 1
+	if (versus >= 0)
+		return run_versus(versus, port, seed, (DWORD) delay, (DWORD) jitter, (DWORD) ticks);
+
+	if (export_prefix)
+	{
+		// -games bot games of at most -pieces pieces each
+		struct tuner_config_t config = { 0, 0, seeds, pieces, threads, seed };
+		return run_export(export_prefix, &config);
+	}
+
+	// -board or an empty well, without playing a game first
+	if (queue || survive)
+		return solve(layout, queue, survive, threads, memory);
+
+	struct piece_stream_t stream;
+	piece_stream_init(&stream, seed, 0, PIECE_BAG);
+	game_init(&game, &stream);
+	game_apply(&game, ACTION_START, 1);
+
+	// -rollout ms plays with the Monte Carlo evaluator, that many milliseconds per move
+	struct rollout_pool_t *pool = NULL;
+	struct rollout_stats_t rollout_stats = { 0, 0, 0, 0 };
+
+	struct surface_cache_t cache;
+	surface_cache_open(&cache);
+
+	if (rollout)
+	{
+		pool = new struct rollout_pool_t;
+		rollout_pool_create(pool, threads);
+	}
+
+	for (int i = 0; i < pieces && game.fStart; i++)
+	{
+		struct board_t board;
+		struct placement_t placement;
+
+		board_from_field(&game, &board);
+		if (pool)
+		{
+			if (!rollout_choose(pool, &board, game.active_piece.shape, game.next_piece.shape, rollout, seed + i, &placement, &rollout_stats))
+				break;
+		}
+		else if (!bot_choose_placement(&board, game.active_piece.shape, game.next_piece.shape, &default_weights, &cache, &placement))
+			break;
+
+		game_place(&game, &placement, NULL);
+	}
+
+	if (!pool)
+	{
+		print_surface_stats(&cache);
+		if (save_surface && !surface_cache_save(&cache, save_surface))
+			fprintf(stderr, "cannot write %s\n", save_surface);
+	}
+	surface_cache_destroy(&cache);
+
+	if (pool)
+	{
+		printf("%d threads: %llu rollouts in %.3f s, %.0f rollouts/s, %d rounds, %d candidates cut early\n", pool->threads, rollout_stats.rollouts,
+			rollout_stats.seconds, rollout_stats.seconds > 0 ? rollout_stats.rollouts / rollout_stats.seconds : 0.0, rollout_stats.rounds, rollout_stats.pruned);
+
+		rollout_pool_destroy(pool);
+		delete pool;
+	}
+
+	struct frame_t frame;
+	frame_fill(&frame, &game);
+
+	struct raster_t raster;
+	if (!raster_create(&raster, brick, brick))
+		return 1;
+
+	raster_render(&raster, &frame);
+	printf("level %d, lines %d, score %d, %dx%d pixels\n", frame.level, frame.total_rows, frame.score, raster.frame.width, raster.frame.height);
+
+	int result = 0;
+
+	if (capture && !raster_write_bmp(&raster.frame, capture))
+	{
+		fprintf(stderr, "cannot write %s\n", capture);
+		result = 1;
+	}
+
+	if (golden)
+	{
+		int diff = raster_compare_bmp(&raster.frame, golden);
+		if (diff)
+		{
+			fprintf(stderr, (diff < 0) ? "cannot read %s\n" : "%s differs in %d pixels\n", golden, diff);
+			result = 1;
+		}
+		else
+			printf("matches %s\n", golden);
+	}
+
+	if (fBench)
+	{
+		// full redraws and single piece moves at 4K height (27 rows of 80 pixels is 2160), first
+		// with square bricks and then with bricks 225 wide, 3825x2160, the widest that fit a
+		// 3840x2160 screen. a plain fill of the same buffer is the store bandwidth floor a full
+		// redraw sits on
+		const int BENCH_WIDTHS[2] = { 80, 225 };
+
+		for (int size = 0; size < 2; size++)
+		{
+			struct raster_t large;
+			if (!raster_create(&large, BENCH_WIDTHS[size], 80))
+				return 1;
+
+			const int FRAMES = 200;
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < FRAMES; i++)
+			{
+				large.fValid = FALSE;
+				raster_render(&large, &frame);
+			}
+			auto middle = std::chrono::steady_clock::now();
+
+			struct frame_t moved = frame;
+			for (int i = 0; i < FRAMES; i++)
+			{
+				// a piece stepping one column, plus a score change
+				int col = 1 + (i % 9);
+				moved.field[3][col] = moved.field[3][col + 1] = (BYTE) (1 + (i % 7));
+				moved.field[3][(col + 8) % 9 + 1] = BLACK;
+				moved.score = frame.score + i;
+				raster_render(&large, &moved);
+			}
+			auto end = std::chrono::steady_clock::now();
+
+			for (int i = 0; i < FRAMES; i++)
+				fill_rect(&large.frame, 0, 0, large.frame.width, large.frame.height, PIXEL_BLACK + i);
+			auto filled = std::chrono::steady_clock::now();
+
+			printf("%dx%d: full frame %.3f ms, incremental frame %.3f ms, plain fill %.3f ms\n", large.frame.width, large.frame.height,
+				std::chrono::duration<double, std::milli>(middle - start).count() / FRAMES,
+				std::chrono::duration<double, std::milli>(end - middle).count() / FRAMES,
+				std::chrono::duration<double, std::milli>(filled - end).count() / FRAMES);
+
+			raster_destroy(&large);
+		}
+
+		if (rollout)
+			bench_rollout(rollout, threads, seed);
+	}
+
+	raster_destroy(&raster);
+	return result;
+}
+
+#endif
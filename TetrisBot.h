@@ -0,0 +1,86 @@
+/******************************************************************************************/
+/*                                                                                        */
+/*  WinTris - bot plugin interface                                                        */
+/*                                                                                        */
+/******************************************************************************************/
+
+// a bot plugin is a shared library (.so, .dll) exporting tetris_bot_entry. the engine calls
+// choose once per piece with a view of the live game and applies the answer at full speed.
+// plain C with fixed size fields, so a plugin can be built by any compiler and language that
+// speaks the C calling convention, and the layout only ever grows at the end
+#ifndef TETRIS_BOT_H
+#define TETRIS_BOT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TETRIS_BOT_ABI 1
+
+#if defined(_WIN32)
+#define TETRIS_BOT_EXPORT __declspec(dllexport)
+#else
+#define TETRIS_BOT_EXPORT __attribute__((visibility("default")))
+#endif
+
+// shapes in table order O I T L J Z S, rotations 0 to 3, x and y the top left of the 4x4 grid
+struct tetris_piece_view
+{
+	int32_t shape, rotation;
+	int32_t x, y;
+};
+
+// read only and only valid during the call - the pointers lead straight into the game.
+// cells is the playfield, one byte per cell with 7 for empty, 8 for the walls and floor and
+// the piece colours 0 to 6 otherwise, stride bytes apart. column k of columns has bit n set
+// when the cell n rows above the floor is filled, which is the stack in the form most bots want
+struct tetris_board_view
+{
+	uint32_t abi;
+	int32_t width, height;				// the whole field, walls and floor included
+	const uint8_t *cells;
+	int32_t stride;
+	const uint32_t *columns;			// width entries, the walls read as empty
+	const uint16_t *shapes;				// 7 shapes of 4 rotations, bit 15 - 4 * row - col
+	const int32_t *rotations;			// rotations of each shape
+	struct tetris_piece_view active, next;
+	int32_t score, level, lines;
+	uint32_t budget_us;					// time allowed for this call
+};
+
+// the answer - a target placement the engine steers to and drops, or inputs it plays one
+// tick apart, after which the piece is dropped
+enum tetris_move_kind { TETRIS_MOVE_NONE = 0, TETRIS_MOVE_PLACEMENT, TETRIS_MOVE_INPUTS };
+enum tetris_input { TETRIS_INPUT_ROTATE = 2, TETRIS_INPUT_LEFT, TETRIS_INPUT_RIGHT, TETRIS_INPUT_DROP };
+
+#define TETRIS_BOT_MAX_INPUTS 32
+
+struct tetris_bot_move
+{
+	int32_t kind;
+	int32_t rotation, x;
+	int32_t input_count;
+	uint8_t inputs[TETRIS_BOT_MAX_INPUTS];
+};
+
+struct tetris_bot_api
+{
+	uint32_t abi;						// TETRIS_BOT_ABI the plugin was built against
+	const char *name;
+	void *(*create)(const char *options);
+	void (*destroy)(void *bot);
+	int32_t (*choose)(void *bot, const struct tetris_board_view *view, struct tetris_bot_move *move);
+};
+
+typedef const struct tetris_bot_api *(*tetris_bot_entry_fn)(void);
+
+// the one symbol the engine looks up
+TETRIS_BOT_EXPORT const struct tetris_bot_api *tetris_bot_entry(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif